@@ -33,15 +33,85 @@
 #endif
 
 #include <time.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(DISKUS_NO_SIMD)
+#include <immintrin.h>
+#define	DISKUS_X86
+#endif
+
+#if defined(__linux__) && !defined(DISKUS_NO_URING)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#ifdef __NR_io_uring_setup
+#define	DISKUS_URING
+#endif
+#endif
+
+#if defined(__linux__) && !defined(DISKUS_NO_AIO)
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#ifdef __NR_io_setup
+#define	DISKUS_AIO
+#endif
+#endif
+
+#if defined(__linux__) && !defined(DISKUS_NO_ZEROOUT)
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#if defined(BLKZEROOUT) && defined(FALLOC_FL_ZERO_RANGE)
+#define	DISKUS_ZEROOUT
+#endif
+#endif
+
+#if defined(__linux__) && !defined(DISKUS_NO_PROBE)
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <sched.h>
+#if defined(BLKSSZGET) && defined(BLKPBSZGET) && defined(BLKIOOPT) && defined(BLKGETSIZE64) && defined(CPU_SET)
+#define	DISKUS_PROBE
+#endif
+#endif
+
+#if defined(__linux__) && !defined(DISKUS_NO_VERIFY)
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/nvme_ioctl.h>
+#include <scsi/sg.h>
+#if defined(NVME_IOCTL_IO_CMD) && defined(SG_IO) && defined(BLKGETSIZE64)
+#define	DISKUS_VERIFY
+#endif
+#endif
+
+#if defined(__linux__) && !defined(DISKUS_NO_ARENA)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/mempolicy.h>
+#ifdef MAP_ANONYMOUS
+#define	DISKUS_ARENA
+#endif
+#endif
 
 #include "diskus_version.h"
 
-#define	SECTOR_SIZE		512
+#define	SECTOR_SIZE		512	/* smallest sector size	*/
 #define	SKIP_BYTES		4096
-#define	MAX_SECTOR_SIZE		SECTOR_SIZE
+#define	MAX_SECTOR_SIZE		4096
 #define	DISKUS_MAGIC_SIZE	27
 
 #define	SECTOR_OFFSET(X)	((X)&(SECTOR_SIZE-1))
+#define	SSZ_OFFSET(X)		((X)&(cfg->ssz-1))	/* sector size of the device	*/
 
 /* This is a bitmask	*/
 enum
@@ -56,7 +126,7 @@ enum
     diskus_ret_old	= 64,	/* Checksum timestamp jumps	*/
   };
 static const char	mode_dump[]="dump", mode_gen[]="gen", mode_check[]="check", mode_null[]="null", mode_read[]="read";
-static const char	mode_freshen[]="freshen", mode_patch[]="patch";
+static const char	mode_freshen[]="freshen", mode_patch[]="patch", mode_verify[]="verify", mode_bench[]="bench";
 
 enum diskus_errtype
   {
@@ -68,28 +138,117 @@ enum diskus_errtype
     ERR_DATA_MISMATCH,
     ERR_READ,
     ERR_PATCHED,
+    ERR_STALE,		/* -verify-lag: old timestamp, write was lost	*/
+  };
+
+#define	ZONE_SHIFT	30		/* 1 GiB per zone	*/
+#define	ZONE_BUCKETS	128
+
+struct diskus_zone
+  {
+    unsigned long long	count, sum, min, max;	/* microseconds	*/
+    unsigned		hist[ZONE_BUCKETS];
   };
 
+/* Statistics for the progress meter, see stats_add()
+ */
+#define	STATS_WINDOW	10		/* seconds of the moving average	*/
+
+struct diskus_stats
+  {
+    /* Written by the I/O path only:	*/
+    struct diskus_zone	lat;
+    unsigned long long	bytes;
+    /* Written by stats_tick() only:	*/
+    long long		t0, tlast;	/* usec	*/
+    long long		start;		/* first position	*/
+    unsigned long long	lastbytes, lastios;
+    double		mbps, iops;	/* since the last tick	*/
+    double		avgmbps, avgiops;	/* moving average	*/
+  };
+
+/* diskus_cfg.probed	*/
+#define	PROBED_BS	1
+#define	PROBED_QD	2
+#define	PROBED_END	4
+
 struct diskus_cfg
   {
     int			bs, async;
+    int			ssz;		/* sector size, see get_sector_size()	*/
+    int			sector;		/* option -sector	*/
+    /* Device probe:	*/
+    int			noprobe;
+    int			numa;		/* node of the device, -1 if unknown	*/
+    int			probed;		/* PROBED_* picked by the probe	*/
     const char		*mode;
     long long		nr, pos, endpos;
     int			fd;
     const char		*name;
     TINO_DATA		*out;
-    int			signpos;
+    int			siglen[2];	/* predicted ID lengths, 0 if unknown	*/
     int			err, errtype;
     int			idpos;
     int			expand;
     int			quiet;
     int			hexdump;
+    int			offload;	/* -null zeroes in the device	*/
     int			retflags;
     long long		ts;
+    int			sign;		/* signature version for gen	*/
     const char		*keepfile, *update;
+    struct diskus_keep	*keep;
+    char		keepok;		/* state of good sectors	*/
+    /* Option -zone:	*/
+    const char		*timefile;
+    struct diskus_zone	*zones;
+    int			nzones;
     /* Option -jump:	*/
     int			jump;
     unsigned long long	nxt, skip;
+    /* Option -verify-lag:	*/
+    long long		lag;
+    struct diskus_cfg	*lagcfg;	/* the reader, see lag_open()	*/
+    int			fresh;		/* timestamps must match	*/
+    /* Option -retry:	*/
+    int			retry, retrytime;
+    long long		*retryq;	/* ranges from, to to read again	*/
+    int			nretry, maxretry;
+    /* Option -walk:	*/
+    int			walk, walkarg;	/* WALK_* and its argument	*/
+    unsigned long long	seed;
+    long long		walkfrom, walkto;	/* region	*/
+    long long		walkn, walkdom;	/* blocks and size of the domain	*/
+    int			walkbits;	/* half the Feistel domain	*/
+    /* Option -vary:	*/
+    int			vary, cur;	/* smallest and current blocksize	*/
+    long long		badend;		/* stay small up to here	*/
+    /* Option -engine and -qd:	*/
+    const char		*engine;
+    int			qd;
+    struct diskus_io	*io;
+    /* Option -threads:	*/
+    int			threads;
+    struct diskus_pool	*pool;
+    /* Worker state, per device:	*/
+    struct tino_xd	xd;
+    size_t		nulled;
+    /* Option -jobs:	*/
+    int			jobs, dev;
+    const char		*label;		/* name for output	*/
+    long long		firsterr, lasterr;	/* sectors	*/
+    /* Option -bench:	*/
+    const char		*benchbs, *benchqd, *benchwalk;
+    int			benchtime;
+    int			(*benchfn)(struct diskus_cfg *, unsigned char *, int);
+    long long		benchend;	/* usec	*/
+    /* Statistics, size is for the ETA:	*/
+    struct diskus_stats	stats;
+    long long		size;
+    /* Open error range, see range_add():	*/
+    long long		rfrom, rto;	/* sectors, rto exclusive	*/
+    int			rtype, rcount;
+    time_t		rstart;
   };
 
 #define	CFG	struct diskus_cfg *cfg
@@ -97,15 +256,436 @@ struct diskus_cfg
 typedef int	diskus_worker_fn(CFG, unsigned char *, int);
 typedef int	diskus_run_fn(CFG, diskus_worker_fn worker);
 
+/* One job per device, each with its own cfg and thread
+ */
+struct diskus_job
+  {
+    struct diskus_cfg	cfg;
+    diskus_run_fn	*run;
+    diskus_worker_fn	*fn;
+    const char		*name;
+    int			dev;		/* shards of a device share this	*/
+    long long		start;
+    int			ret, done;
+    pthread_t		tid;
+  };
+
+static struct diskus_job	*diskus_jobs;
+static int			diskus_njobs;
+static pthread_mutex_t		diskus_out = PTHREAD_MUTEX_INITIALIZER;	/* serializes output	*/
+
+/* Latency statistics for option -zone
+ *
+ * Each zone of the device has a histogram of the I/O latencies with
+ * 4 buckets per power of 2 (like HDR histograms), so percentiles are
+ * accurate to 25%.  Slow zones show up before they produce errors.
+ */
+static long long
+diskus_usec(void)
+{
+  struct timespec	ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000ll + ts.tv_nsec/1000;
+}
+
+static int
+zone_bucket(unsigned long long us)
+{
+  int	k, i;
+
+  if (us<4)
+    return us;
+  k	= 63-__builtin_clzll(us);
+  i	= (k-1)*4 + ((us>>(k-2))&3);
+  return i<ZONE_BUCKETS ? i : ZONE_BUCKETS-1;
+}
+
+/* Lowest value of a bucket
+ */
+static unsigned long long
+zone_value(int i)
+{
+  if (i<4)
+    return i;
+  return (4ull+(i&3))<<(i/4-1);
+}
+
+static void
+zone_add(CFG, long long pos, long long us)
+{
+  struct diskus_zone	*z;
+  int			n;
+
+  if (!cfg->timefile)
+    return;
+  n	= pos>>ZONE_SHIFT;
+  if (n>=cfg->nzones)
+    {
+      cfg->zones	= tino_reallocO(cfg->zones, (n+1) * sizeof *cfg->zones);
+      memset(cfg->zones+cfg->nzones, 0, (n+1-cfg->nzones) * sizeof *cfg->zones);
+      cfg->nzones	= n+1;
+    }
+  z	= &cfg->zones[n];
+  if (us<0)
+    us	= 0;
+  if (!z->count || us<z->min)
+    z->min	= us;
+  if (us>z->max)
+    z->max	= us;
+  z->count++;
+  z->sum	+= us;
+  z->hist[zone_bucket(us)]++;
+}
+
+static unsigned long long
+zone_percentile(struct diskus_zone *z, int percent)
+{
+  unsigned long long	want, sum, v;
+  int			i;
+
+  want	= (z->count*percent+99)/100;
+  sum	= 0;
+  for (i=0; i<ZONE_BUCKETS; i++)
+    if ((sum+=z->hist[i])>=want)
+      break;
+  v	= zone_value(i<ZONE_BUCKETS ? i : ZONE_BUCKETS-1);
+  return v<z->min ? z->min : v>z->max ? z->max : v;
+}
+
+/* Append the zones as CSV to the -zone file
+ */
+static int
+zone_write(CFG)
+{
+  FILE	*fd;
+  int	i;
+
+  if (!cfg->timefile || !cfg->nzones)
+    return 0;
+  pthread_mutex_lock(&diskus_out);
+  if ((fd=fopen(cfg->timefile, "a"))==NULL)
+    {
+      pthread_mutex_unlock(&diskus_out);
+      TINO_ERR1("ETTDU141A %s: cannot open zone file", cfg->timefile);
+      return diskus_ret_param;
+    }
+  if (!ftell(fd))
+    fprintf(fd, "device,mode,from,to,count,min_us,mean_us,p50_us,p90_us,p99_us,max_us\n");
+  for (i=0; i<cfg->nzones; i++)
+    {
+      struct diskus_zone	*z=&cfg->zones[i];
+
+      if (z->count)
+	fprintf(fd, "%s,%s,%lld,%lld,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", cfg->name, cfg->mode,
+		(long long)i<<ZONE_SHIFT, ((long long)i+1)<<ZONE_SHIFT, z->count, z->min, z->sum/z->count,
+		zone_percentile(z, 50), zone_percentile(z, 90), zone_percentile(z, 99), z->max);
+    }
+  i	= fclose(fd);
+  pthread_mutex_unlock(&diskus_out);
+  if (i)
+    {
+      TINO_ERR1("ETTDU141A %s: cannot write zone file", cfg->timefile);
+      return diskus_ret_param;
+    }
+  return 0;
+}
+
+/* Statistics
+ *
+ * stats_add() is called from the I/O path of a device.  There is
+ * only one writer per device, so no locks and no atomic
+ * read-modify-write are needed, the atomic stores only keep the
+ * readers from seeing torn values.  stats_tick() runs once a second
+ * from print_state() and derives the rates.
+ */
+#define	STATS_SET(V,X)	__atomic_store_n(&(V), (X), __ATOMIC_RELAXED)
+#define	STATS_GET(V)	__atomic_load_n(&(V), __ATOMIC_RELAXED)
+
+static pthread_mutex_t		diskus_tick = PTHREAD_MUTEX_INITIALIZER;	/* one stats_tick() at a time	*/
+static volatile sig_atomic_t	diskus_usr1;	/* SIGUSR1 seen	*/
+
+static void
+stats_add(CFG, int bytes, long long us)
+{
+  struct diskus_stats	*st=&cfg->stats;
+  int			i;
+
+  if (us<0)
+    us	= 0;
+  if (!st->lat.count || us<st->lat.min)
+    STATS_SET(st->lat.min, us);
+  if (us>st->lat.max)
+    STATS_SET(st->lat.max, us);
+  i	= zone_bucket(us);
+  STATS_SET(st->lat.hist[i], st->lat.hist[i]+1);
+  STATS_SET(st->lat.sum, st->lat.sum+us);
+  STATS_SET(st->bytes, st->bytes+bytes);
+  STATS_SET(st->lat.count, st->lat.count+1);
+}
+
+static void
+stats_start(CFG)
+{
+  memset(&cfg->stats, 0, sizeof cfg->stats);
+  cfg->stats.t0		= diskus_usec();
+  cfg->stats.tlast	= cfg->stats.t0;
+  cfg->stats.start	= cfg->pos;
+}
+
+/* Consistent enough copy of the latencies for zone_percentile()
+ */
+static void
+stats_lat(CFG, struct diskus_zone *z)
+{
+  int	i;
+
+  z->count	= STATS_GET(cfg->stats.lat.count);
+  z->sum	= STATS_GET(cfg->stats.lat.sum);
+  z->min	= STATS_GET(cfg->stats.lat.min);
+  z->max	= STATS_GET(cfg->stats.lat.max);
+  for (i=0; i<ZONE_BUCKETS; i++)
+    z->hist[i]	= STATS_GET(cfg->stats.lat.hist[i]);
+}
+
+static void
+stats_tick(CFG)
+{
+  struct diskus_stats	*st=&cfg->stats;
+  unsigned long long	bytes, ios;
+  long long		now;
+  double		dt, w;
+
+  now	= diskus_usec();
+  if (!st->t0 || now<=st->tlast)
+    return;
+  dt	= (now-st->tlast)/1000000.;
+  bytes	= STATS_GET(st->bytes);
+  ios	= STATS_GET(st->lat.count);
+  st->mbps	= (bytes-st->lastbytes)/1000000./dt;
+  st->iops	= (ios-st->lastios)/dt;
+  w		= st->tlast==st->t0 ? 1 : dt/(dt+STATS_WINDOW);
+  st->avgmbps	+= (st->mbps-st->avgmbps)*w;
+  st->avgiops	+= (st->iops-st->avgiops)*w;
+  st->lastbytes	= bytes;
+  st->lastios	= ios;
+  st->tlast	= now;
+}
+
+/* Seconds until cfg->endpos (or the end of the device), -1 if unknown
+ */
+static long
+stats_eta(CFG)
+{
+  long long	end;
+
+  end	= cfg->endpos ? cfg->endpos : cfg->size;
+  if (!end || cfg->stats.avgmbps<=0)
+    return -1;
+  if (cfg->pos>=end)
+    return 0;
+  return (end-cfg->pos)/(cfg->stats.avgmbps*1000000.);
+}
+
+/* Errors per GiB done
+ */
+static double
+stats_errrate(CFG)
+{
+  long long	done;
+
+  done	= cfg->pos-cfg->stats.start;
+  return done>0 ? cfg->err*(double)(1<<30)/done : 0;
+}
+
+static const char *
+stats_eta_str(CFG)
+{
+  static char	buf[40];
+  long		eta;
+
+  if ((eta=stats_eta(cfg))<0)
+    return "-";
+  snprintf(buf, sizeof buf, "%ld:%02ld:%02ld", eta/3600, eta/60%60, eta%60);
+  return buf;
+}
+
+/* Full statistics, on SIGUSR1
+ */
+static void
+stats_dump(CFG)
+{
+  struct diskus_zone	z;
+
+  stats_lat(cfg, &z);
+  pthread_mutex_lock(&diskus_out);
+  fprintf(stderr, "%s: %s pos=%lld %.1fMB/s (avg %.1f) %.0fIOPS (avg %.0f) lat min/avg/p99/max %llu/%llu/%llu/%lluus ETA %s errs=%d (%.2f/GiB)\033[K\n",
+	  cfg->label ? cfg->label : cfg->name, cfg->mode, cfg->pos,
+	  cfg->stats.mbps, cfg->stats.avgmbps, cfg->stats.iops, cfg->stats.avgiops,
+	  z.min, z.count ? z.sum/z.count : 0, z.count ? zone_percentile(&z, 99) : 0, z.max,
+	  stats_eta_str(cfg), cfg->err, stats_errrate(cfg));
+  fflush(stderr);
+  pthread_mutex_unlock(&diskus_out);
+}
+
+static void
+stats_usr1(int sig)
+{
+  diskus_usr1	= 1;
+}
+
+/* kill -USR1 dumps the statistics of all devices with the next tick
+ */
+static void
+stats_signal(void)
+{
+  struct sigaction	sa;
+
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler	= stats_usr1;
+  sa.sa_flags	= SA_RESTART;
+  sigaction(SIGUSR1, &sa, NULL);
+}
+
+/* Option -json: Events as JSON lines.
+ *
+ * The stream is fully buffered and flushed with each progress tick,
+ * so the scan does not wait for the log.  Positions are given in
+ * bytes and in sectors, times in seconds, latencies in microseconds.
+ */
+static FILE			*diskus_json;
+static FILE			*diskus_errfile;	/* option -errfile	*/
+static const char		*diskus_errnames[] =
+  { "none", "signature-missing", "signature-invalid1", "signature-invalid2",
+    "signature-mismatch", "data-mismatch", "read", "patched", "stale" };
+
+static void
+json_str(const char *s)
+{
+  for (; *s; s++)
+    if (*s=='"' || *s=='\\')
+      fprintf(diskus_json, "\\%c", *s);
+    else if ((unsigned char)*s<32)
+      fprintf(diskus_json, "\\u%04x", *s);
+    else
+      putc(*s, diskus_json);
+}
+
+/* Start a record, diskus_out must be locked
+ */
+static void
+json_head(CFG, const char *event)
+{
+  fprintf(diskus_json, "{\"event\":\"%s\",\"time\":%ld,\"dev\":\"", event, (long)time(NULL));
+  json_str(cfg->label ? cfg->label : cfg->name);
+  fprintf(diskus_json, "\",\"mode\":\"%s\"", cfg->mode);
+}
+
+static void
+json_error(CFG, int err, long long from, long long to, int count)
+{
+  if (!diskus_json)
+    return;
+  pthread_mutex_lock(&diskus_out);
+  json_head(cfg, "error");
+  fprintf(diskus_json, ",\"type\":\"%s\",\"sector\":%lld,\"sectors\":%lld,\"pos\":%lld,\"bytes\":%lld,\"errors\":%d}\n",
+	  diskus_errnames[err], from, to-from, from*cfg->ssz, (to-from)*cfg->ssz, count);
+  pthread_mutex_unlock(&diskus_out);
+}
+
+/* Latencies of all I/O so far
+ */
+static void
+json_lat(CFG)
+{
+  struct diskus_zone	z;
+
+  stats_lat(cfg, &z);
+  fprintf(diskus_json, ",\"ios\":%llu,\"lat_min\":%llu,\"lat_avg\":%llu,\"lat_p99\":%llu,\"lat_max\":%llu",
+	  z.count, z.min, z.count ? z.sum/z.count : 0, z.count ? zone_percentile(&z, 99) : 0, z.max);
+}
+
+static void
+json_progress(CFG)
+{
+  pthread_mutex_lock(&diskus_out);
+  json_head(cfg, "progress");
+  fprintf(diskus_json, ",\"sector\":%lld,\"pos\":%lld,\"errors\":%d,\"mbps\":%.3f,\"iops\":%.1f,\"avg_mbps\":%.3f,\"avg_iops\":%.1f,\"eta\":%ld",
+	  cfg->nr, cfg->pos, cfg->err, cfg->stats.mbps, cfg->stats.iops, cfg->stats.avgmbps, cfg->stats.avgiops, stats_eta(cfg));
+  json_lat(cfg);
+  fprintf(diskus_json, "}\n");
+  fflush(diskus_json);
+  pthread_mutex_unlock(&diskus_out);
+}
+
+static void
+json_summary(CFG, int ret, long runtime, long long bytes)
+{
+  if (!diskus_json)
+    return;
+  pthread_mutex_lock(&diskus_out);
+  json_head(cfg, "summary");
+  fprintf(diskus_json, ",\"result\":\"%s\",\"sector\":%lld,\"pos\":%lld,\"errors\":%d,\"ret\":%d,\"seconds\":%ld,\"mbps\":%.3f",
+	  (ret || cfg->err ? "failed" : "success"), cfg->nr, cfg->pos, cfg->err, cfg->retflags|ret, runtime, bytes/(double)(diskus_usec()-cfg->stats.t0+1));
+  json_lat(cfg);
+  if (cfg->err)
+    fprintf(diskus_json, ",\"first\":%lld,\"last\":%lld", cfg->firsterr, cfg->lasterr);
+  fprintf(diskus_json, "}\n");
+  fflush(diskus_json);
+  pthread_mutex_unlock(&diskus_out);
+}
+
+static int
+print_table(long runtime)
+{
+  int	i;
+
+  if (pthread_mutex_trylock(&diskus_out))
+    return 0;
+  fprintf(stderr, "%s\n", tino_scale_interval(1, runtime, 1, -6));
+  for (i=0; i<diskus_njobs; i++)
+    {
+      struct diskus_job	*job=&diskus_jobs[i];
+
+      fprintf(stderr, "%-24s %s %10lldS %siB %7.1fMB/s %8s %6d %s\033[K\n", job->cfg.label, job->cfg.mode, job->cfg.nr, tino_scale_bytes(2, job->cfg.pos, 2, -9),
+	      job->cfg.stats.avgmbps, stats_eta_str(&job->cfg), job->cfg.err, (!job->done ? "" : job->ret ? "failed" : "done"));
+    }
+  if (isatty(2))
+    fprintf(stderr, "\033[%dA", diskus_njobs+1);	/* overwrite the table next time	*/
+  fflush(stderr);
+  pthread_mutex_unlock(&diskus_out);
+  return 0;
+}
+
 static int
 print_state(void *user, long delta, time_t now, long runtime)
 {
   struct diskus_cfg	*cfg=user;
+  int			i, dump;
+
+  if (pthread_mutex_trylock(&diskus_tick))
+    return 0;
+  dump		= diskus_usr1;
+  diskus_usr1	= 0;
+  for (i=0; i<(diskus_njobs>1 ? diskus_njobs : 1); i++)
+    {
+      struct diskus_cfg	*c=diskus_njobs>1 ? &diskus_jobs[i].cfg : cfg;
+
+      stats_tick(c);
+      if (diskus_json)
+	json_progress(c);
+      if (dump)
+	stats_dump(c);
+    }
+  pthread_mutex_unlock(&diskus_tick);
 
   if (cfg->quiet)
-    return cfg->quiet==1 ? 0 : 1;
+    return cfg->quiet==1 || diskus_json ? 0 : 1;
+  if (diskus_njobs>1)
+    return print_table(runtime);
 
-  fprintf(stderr, "%s %s %10lldS %siB %d \r", tino_scale_interval(1, runtime, 1, -6), cfg->mode, cfg->nr, tino_scale_bytes(2, cfg->pos, 2, -9), cfg->err);
+  fprintf(stderr, "%s %s %10lldS %siB %d %.1fMB/s %.0fIOPS ETA %s \r", tino_scale_interval(1, runtime, 1, -6), cfg->mode, cfg->nr, tino_scale_bytes(2, cfg->pos, 2, -9), cfg->err,
+	  cfg->stats.avgmbps, cfg->stats.avgiops, stats_eta_str(cfg));
   fflush(stderr);
 
   return 0;
@@ -118,6 +698,11 @@ get_pos_str(CFG)
 }
 
 /* This requires repositioning like it is done in run_read_type()
+ *
+ * The block is written back with pwrite(), so the file position need
+ * not be moved twice.  Rewriting in place cannot be offloaded to the
+ * device: copy_file_range() refuses overlapping ranges and a copy to
+ * some other place does not refresh anything.
  */
 static int
 freshen_worker(CFG, unsigned char *ptr, int len)
@@ -127,31 +712,28 @@ freshen_worker(CFG, unsigned char *ptr, int len)
   if (!ptr || len<0)
     return 0;
 
-  if (tino_file_lseekE(cfg->fd, cfg->pos, SEEK_SET)!=cfg->pos)
-    {
-      TINO_ERR2("ETTDU106E %s: cannot seek to %lld", cfg->name, cfg->pos);
-      return diskus_ret_seek;
-    }
-  put	= tino_file_writeE(cfg->fd, ptr, len);
+  do
+    put	= pwrite(cfg->fd, ptr, len, cfg->pos);
+  while (put<0 && errno==EINTR);
   if (put<0)
     {
       TINO_ERR3("ETTDU121B %s: rewrite error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
       return -1;
     }
-  if (SECTOR_OFFSET(put))
+  if (SSZ_OFFSET(put))
     {
-      cfg->nr	+= put/SECTOR_SIZE;
-      TINO_ERR6("ETTDU122A %s: partial sector %lld written: %d pos=%lld (%lld+%d)", cfg->name, cfg->nr, SECTOR_OFFSET(put), cfg->pos, cfg->pos-put, put);
-      put	-= SECTOR_OFFSET(put);
+      cfg->nr	+= put/cfg->ssz;
+      TINO_ERR6("ETTDU122A %s: partial sector %lld written: %d pos=%lld (%lld+%d)", cfg->name, cfg->nr, SSZ_OFFSET(put), cfg->pos, cfg->pos-put, put);
+      put	-= SSZ_OFFSET(put);
       cfg->pos	+= put;
       return -1;
     }
   if (put!=len)
     TINO_ERR5("WTTDU123A %s: short write: %d instead of %d at pos=%lld (now %lld)", cfg->name, put, len, cfg->pos, cfg->pos+put);
-  if (put>SECTOR_SIZE && put>cfg->bs/2)
+  if (put>cfg->ssz && put>cfg->bs/2)
     put	/= 2;			/* double step freshen, such that we run over each position two times with interleaving	*/
   cfg->pos	+= put;
-  cfg->nr	+= put/SECTOR_SIZE;
+  cfg->nr	+= put/cfg->ssz;
   return 1;	/* reseek needed	*/
 }
 
@@ -161,7 +743,7 @@ read_worker(CFG, unsigned char *ptr, int len)
   if (!ptr || len<0)
     return 0;
 
-  cfg->nr	+= len/SECTOR_SIZE;
+  cfg->nr	+= len/cfg->ssz;
   cfg->pos	+= len;
   return 0;
 }
@@ -174,569 +756,3843 @@ dump_sect(CFG, int off, unsigned char *ptr)
   if (!cfg->hexdump)
     return;
   tino_xd_init(&xd, cfg->out, "", -10, cfg->pos+off, 1);
-  tino_xd_do(&xd, ptr, SECTOR_SIZE);
+  tino_xd_do(&xd, ptr, cfg->ssz);
   tino_xd_exit(&xd);
 }
 
 static int
 dump_worker(CFG, unsigned char *ptr, int len)
 {
-  static struct tino_xd	xd;
-
   if (len<0)
     return 0;
   if (!ptr)
     {
       if (len>0)
-	tino_xd_init(&xd, cfg->out, "", -10, cfg->pos, 1);
+	tino_xd_init(&cfg->xd, cfg->out, "", -10, cfg->pos, 1);
       else
-	tino_xd_exit(&xd);
+	tino_xd_exit(&cfg->xd);
     }
   else
     {
-      tino_xd_do(&xd, ptr, len);
-      cfg->nr	+= len/SECTOR_SIZE;
+      tino_xd_do(&cfg->xd, ptr, len);
+      cfg->nr	+= len/cfg->ssz;
       cfg->pos	+= len;
     }
   return 0;
 }
 
-static void
-create_sector(long long nr, unsigned char *ptr, char *id, int len)
+/* Sector pattern
+ *
+ * Byte i of a sector is md5[i%16] ^ sector_mask[i], where md5 is the
+ * MD5 of the ID string, followed by the ID string itself at a
+ * position depending on the sector number.  The mask repeats every
+ * 512 bytes, so larger sectors look like 512 byte sectors glued
+ * together, except for the ID.
+ */
+static unsigned char	sector_mask[MAX_SECTOR_SIZE] __attribute__((aligned(64)));
+
+/* Bits of a w byte chunk at i which are not within [from,to)
+ */
+static unsigned long long
+sector_keep(int i, int w, int from, int to)
 {
-  int	i;
+  unsigned long long	all;
+
+  all	= w<64 ? (1ull<<w)-1 : ~0ull;
+  if (from<i)
+    from	= i;
+  if (to>i+w)
+    to	= i+w;
+  if (from>=to)
+    return all;
+  return all & ~((to-i<64 ? (1ull<<(to-i))-1 : ~0ull) & ~((1ull<<(from-i))-1));
+}
+
+/* Return the index of the first byte which differs from the pattern
+ * outside of [from,to), -1 if none.
+ */
+static int
+sector_diff_c(const unsigned char *ptr, const unsigned char *pat, int from, int to, int ssz)
+{
+  unsigned long long	p[2], a, b;
+  int			i, k;
 
-  tino_md5_bin(id, len, ptr);
-  for (i=16; i<SECTOR_SIZE; i+=16)
-    memcpy(ptr+i, ptr, 16);
-  for (i=SECTOR_SIZE/2; --i>=0; )
+  memcpy(p, pat, 16);
+  for (i=0; i<ssz; i+=16)
     {
-      ptr[i]	^= i;
-      ptr[511-i]	^= i;
+      memcpy(&a, ptr+i, 8);
+      memcpy(&b, sector_mask+i, 8);
+      if ((a^b)==p[0])
+	{
+	  memcpy(&a, ptr+i+8, 8);
+	  memcpy(&b, sector_mask+i+8, 8);
+	  if ((a^b)==p[1])
+	    continue;
+	}
+      for (k=i; k<i+16; k++)
+	if ((ptr[k]^sector_mask[k])!=pat[k&15] && (k<from || k>=to))
+	  return k;
     }
-  memcpy(ptr+(nr%(SECTOR_SIZE-len+1)), id, len);
+  return -1;
 }
 
+#ifdef DISKUS_X86
+__attribute__((target("sse2")))
 static int
-find_signature(CFG, const unsigned char *ptr)
+sector_diff_sse2(const unsigned char *ptr, const unsigned char *pat, int from, int to, int ssz)
 {
-  int	i, j;
+  __m128i		p;
+  unsigned long long	m;
+  int			i;
 
-  j	= cfg->signpos;
-  for (i=SECTOR_SIZE-DISKUS_MAGIC_SIZE; --i>=0; )
+  p	= _mm_loadu_si128((const __m128i *)pat);
+  for (i=0; i<ssz; i+=16)
     {
-      if (!memcmp(ptr+j, "[DISKUS ", 8))
-	return j;
-      j++;
-      j	%= SECTOR_SIZE-DISKUS_MAGIC_SIZE;
+      __m128i	x;
+
+      x	= _mm_xor_si128(_mm_loadu_si128((const __m128i *)(ptr+i)), _mm_load_si128((const __m128i *)(sector_mask+i)));
+      m	= ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, p)) & 0xffff;
+      if (m && (m &= sector_keep(i, 16, from, to))!=0)
+	return i+__builtin_ctzll(m);
     }
   return -1;
 }
 
-static void
-diskus_vlog(CFG, TINO_VA_LIST list)
+__attribute__((target("avx2")))
+static int
+sector_diff_avx2(const unsigned char *ptr, const unsigned char *pat, int from, int to, int ssz)
 {
-  tino_data_printfA(cfg->out, "sector %llu: ", cfg->nr);
-  tino_data_vsprintfA(cfg->out, list);
-  tino_data_printfA(cfg->out, "\n");
-  tino_data_syncA(cfg->out, 0);
+  __m256i		p;
+  unsigned long long	m;
+  int			i;
+
+  p	= _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)pat));
+  for (i=0; i<ssz; i+=32)
+    {
+      __m256i	x;
+
+      x	= _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(ptr+i)), _mm256_load_si256((const __m256i *)(sector_mask+i)));
+      m	= ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, p)) & 0xffffffffull;
+      if (m && (m &= sector_keep(i, 32, from, to))!=0)
+	return i+__builtin_ctzll(m);
+    }
+  return -1;
 }
 
-static void
-diskus_log(CFG, const char *text, ...)
+__attribute__((target("avx512f,avx512bw")))
+static int
+sector_diff_avx512(const unsigned char *ptr, const unsigned char *pat, int from, int to, int ssz)
 {
-  tino_va_list	list;
+  __m512i		p;
+  unsigned long long	m;
+  int			i;
 
-  tino_va_start(list, text);
-  diskus_vlog(cfg, &list);
-  tino_va_end(list);
+  p	= _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)pat));
+  for (i=0; i<ssz; i+=64)
+    {
+      __m512i	x;
+
+      x	= _mm512_xor_si512(_mm512_loadu_si512(ptr+i), _mm512_load_si512(sector_mask+i));
+      m	= _mm512_cmpneq_epi8_mask(x, p);
+      if (m && (m &= sector_keep(i, 64, from, to))!=0)
+	return i+__builtin_ctzll(m);
+    }
+  return -1;
 }
+#endif
+
+static int	(*sector_diff)(const unsigned char *, const unsigned char *, int, int, int) = sector_diff_c;
 
+/* Must be called before any sector is created or compared
+ */
 static void
-diskus_err(CFG, enum diskus_errtype err, int retflag, const char *text, ...)
+sector_init(void)
 {
-  tino_va_list	list;
-
-  xDP(("(%p, %d, %d, %s, ..)", cfg, err, retflag, text));
+  int	i;
 
-  if (cfg->errtype!=err || cfg->expand)
+  for (i=MAX_SECTOR_SIZE; --i>=0; )
     {
-      tino_va_start(list, text);
-      diskus_vlog(cfg, &list);
-      tino_va_end(list);
+      int	k;
+
+      k			= i&(SECTOR_SIZE-1);
+      sector_mask[i]	= k<SECTOR_SIZE/2 ? k : SECTOR_SIZE-1-k;
     }
+#ifdef DISKUS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw"))
+    sector_diff	= sector_diff_avx512;
+  else if (__builtin_cpu_supports("avx2"))
+    sector_diff	= sector_diff_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    sector_diff	= sector_diff_sse2;
+#endif
+}
 
-  cfg->errtype	=  err;
-  cfg->retflags	|= retflag;
-  cfg->err++;
+/* The sector functions get the sector size as an argument, such that
+ * it becomes a constant when they are inlined into the kernels, see
+ * SECTOR_KERNELS().
+ */
+static inline void
+sector_fill(unsigned char *ptr, const unsigned char *pat, int ssz)
+{
+  int	i, k;
+
+  /* gcc vectorizes this	*/
+  for (i=0; i<ssz; i+=16)
+    for (k=0; k<16; k++)
+      ptr[i+k]	= pat[k]^sector_mask[i+k];
 }
 
-/* This requires repositioning like it is done in run_read_type()
+/* Signature versions
+ *
+ * 1: "[DISKUS %016llx %lld]", pattern is the MD5 of the ID
+ * 2: "[DISKUS2 %016llx %lld]", pattern is a mix of sector number and
+ *    timestamp, which is far cheaper than MD5.
  */
 static int
-patch_worker(CFG, unsigned char *ptr, int len)
+sector_id(char *id, size_t max, int sign, long long nr, long long ts)
 {
-  int		put;
-  size_t	all;
+  return snprintf(id, max, sign==2 ? "[DISKUS2 %016llx %lld]" : "[DISKUS %016llx %lld]", nr, ts);
+}
 
-  if (!ptr)
-    return 0;
-  if (len>=0)
+/* splitmix64 finalizer
+ */
+static unsigned long long
+sector_mix(unsigned long long x)
+{
+  x	^= x>>30;
+  x	*= 0xbf58476d1ce4e5b9ull;
+  x	^= x>>27;
+  x	*= 0x94d049bb133111ebull;
+  x	^= x>>31;
+  return x;
+}
+
+static void
+sector_pat(unsigned char *pat, int sign, long long nr, long long ts, const char *id, int len)
+{
+  unsigned long long	a, b;
+  int			i;
+
+  if (sign!=2)
     {
-      /* Just update counters	*/
-      cfg->pos	+= len;
-      cfg->nr	+= len/SECTOR_SIZE;
-      return 0;
+      tino_md5_bin(id, len, pat);
+      return;
     }
-
-  all = -len;
-  if (all!=cfg->bs)
+  a	= sector_mix((unsigned long long)nr*0x9e3779b97f4a7c15ull + (unsigned long long)ts);
+  b	= sector_mix(a ^ (unsigned long long)ts ^ 0x5d15c05ull);
+  for (i=0; i<8; i++)		/* same on all byte orders	*/
     {
-      TINO_ERR1("ETTDU111F incomplete block to write: %d", all);
-      return diskus_ret_param;
+      pat[i]	= a>>(8*i);
+      pat[i+8]	= b>>(8*i);
     }
-  if (all&(all-1))
+}
+
+static inline void
+create_sector(long long nr, unsigned char *ptr, const unsigned char *pat, const char *id, int len, int ssz)
+{
+  sector_fill(ptr, pat, ssz);
+  memcpy(ptr+(nr%(ssz-len+1)), id, len);
+}
+
+/* Compare a sector against what create_sector() would create, without
+ * creating it.  Returns the index of the first wrong byte, -1 if
+ * the sector is good.
+ */
+static inline int
+compare_sector(long long nr, const unsigned char *ptr, const unsigned char *pat, const char *id, int len, int ssz)
+{
+  int		off, i, k;
+
+  off	= nr%(ssz-len+1);
+  i	= sector_diff(ptr, pat, off, off+len, ssz);
+  if (i>=0 && i<off)
+    return i;
+  for (k=0; k<len; k++)
+    if (ptr[off+k]!=(unsigned char)id[k])
+      return off+k;
+  return i;
+}
+
+/* Predict where create_sector() puts the ID of the next sectors.
+ * This assumes the timestamp of the sectors seen before, the length
+ * of the ID does not depend on the sector number.
+ */
+static void
+sector_predict(CFG)
+{
+  char	id[64];
+  int	i;
+
+  for (i=0; i<2; i++)
+    cfg->siglen[i]	= cfg->ts ? sector_id(id, sizeof id, i+1, 0ll, cfg->ts) : 0;
+}
+
+static int
+is_signature(const unsigned char *ptr)
+{
+  return !memcmp(ptr, "[DISKUS", 7) && (ptr[7]==' ' || ptr[7]=='2');
+}
+
+/* Find the ID of sector nr.  Usually it is where sector_predict()
+ * expects it, so this is only a single compare.  Else search for the
+ * first '[', which memchr() does vectorized.
+ */
+static inline int
+find_signature(CFG, const unsigned char *ptr, long long nr, int ssz)
+{
+  const unsigned char	*p, *end;
+  int			i, off;
+
+  for (i=0; i<2; i++)
+    if (cfg->siglen[i] && is_signature(ptr+(off=nr%(ssz-cfg->siglen[i]+1))))
+      return off;
+
+  end	= ptr+ssz-DISKUS_MAGIC_SIZE;	/* last possible position	*/
+  for (p=ptr; p<=end && (p=memchr(p, '[', end-p+1))!=NULL; p++)
+    if (is_signature(p))
+      return p-ptr;
+  return -1;
+}
+
+/* Sector state map for option -keep
+ *
+ * The map is a sorted list of extents (in sectors) with a state
+ * letter, sectors not in the list are 'M'issing.  The file is a
+ * journal of lines "S from-to" (inclusive), later lines win.  While
+ * running, state changes are appended (and flushed every few seconds)
+ * such that an interrupted run can be continued.  On close the file
+ * is rewritten from the map.
+ */
+#define	KEEP_STATES	"OVRWENGSPM"
+#define	KEEP_FLUSH	10	/* seconds	*/
+
+struct diskus_extent
+  {
+    long long		from, to;	/* [from,to) in sectors	*/
+    char		state;
+  };
+
+struct diskus_keep
+  {
+    const char			*name;
+    FILE			*fd;
+    pthread_mutex_t		mutex;
+    struct diskus_extent	*map;
+    int				n, max;
+    struct diskus_extent	open;		/* not yet in the journal	*/
+    time_t			flushed;
+    /* Signature of gen, see keep_gen():	*/
+    long long			ts;
+    int				sign, ssz;
+  };
+
+/* Index of the first extent which ends behind sect
+ */
+static int
+keep_find(struct diskus_keep *keep, long long sect)
+{
+  int	lo, hi;
+
+  for (lo=0, hi=keep->n; lo<hi; )
     {
-      TINO_ERR1("ETTDU112F blocksize not power of 2: %d", all);
-      return diskus_ret_param;
+      int	mid=(lo+hi)/2;
+
+      if (keep->map[mid].to<=sect)
+	lo	= mid+1;
+      else
+	hi	= mid;
     }
-  if (all<512 || all>65536)
+  return lo;
+}
+
+static char
+keep_get(struct diskus_keep *keep, long long sect)
+{
+  int	i;
+
+  i	= keep_find(keep, sect);
+  return i<keep->n && keep->map[i].from<=sect ? keep->map[i].state : 'M';
+}
+
+static void
+keep_put(struct diskus_keep *keep, long long from, long long to, char state)
+{
+  struct diskus_extent	add[3];
+  int			i, j, k, cnt;
+
+  if (from>=to)
+    return;
+
+  /* Fast path: extend the last extent	*/
+  if (keep->n && keep->map[keep->n-1].to==from && keep->map[keep->n-1].state==state)
     {
-      TINO_ERR1("ETTDU113F unsupported blocksize: must be 512 to 64K: %d", all);
-      return diskus_ret_param;
+      keep->map[keep->n-1].to	= to;
+      return;
     }
-  if (cfg->pos&(cfg->bs-1))
+
+  /* [i,j) are the extents touching [from,to)	*/
+  for (i=keep->n; i>0 && keep->map[i-1].to>=from; i--);
+  for (j=i; j<keep->n && keep->map[j].from<=to; j++);
+
+  cnt	= 0;
+  if (i<j && keep->map[i].from<from)
     {
-      TINO_ERR2("ETTDU114F %s: attempt to seek to non sector boundary %lld", cfg->name, cfg->pos);
-      return diskus_ret_seek;
+      add[cnt]		= keep->map[i];
+      add[cnt++].to	= from;
     }
-  if (tino_file_lseekE(cfg->fd, cfg->pos, SEEK_SET)!=cfg->pos)
+  add[cnt].from		= from;
+  add[cnt].to		= to;
+  add[cnt++].state	= state;
+  if (i<j && keep->map[j-1].to>to)
     {
-      TINO_ERR2("ETTDU106E %s: cannot seek to %lld", cfg->name, cfg->pos);
-      return diskus_ret_seek;
+      add[cnt]		= keep->map[j-1];
+      add[cnt++].from	= to;
     }
-  memset(ptr, 0, all);
-  put	= tino_file_writeE(cfg->fd, ptr, all);
-  if (put<0)
+
+  /* merge with the neighbours of the same state	*/
+  for (k=1; k<cnt; )
+    if (add[k-1].state==add[k].state)
+      {
+	add[k-1].to	= add[k].to;
+	memmove(add+k, add+k+1, (--cnt-k) * sizeof *add);
+      }
+    else
+      k++;
+
+  if (keep->n-(j-i)+cnt>keep->max)
     {
-      TINO_ERR3("ETTDU105A %s: write error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
-      return diskus_ret_write;
+      keep->max	= keep->max*2+16;
+      keep->map	= tino_reallocO(keep->map, keep->max * sizeof *keep->map);
     }
-  if (put!=all)
-    TINO_ERR5("WTTDU123A %s: short write: %d instead of %d at pos=%lld (now %lld)", cfg->name, put, all, cfg->pos, cfg->pos+put);
-  else
-    diskus_err(cfg, ERR_PATCHED, diskus_ret_read, "patched");
+  memmove(keep->map+i+cnt, keep->map+j, (keep->n-j) * sizeof *keep->map);
+  memcpy(keep->map+i, add, cnt * sizeof *add);
+  keep->n	+= cnt-(j-i);
+}
 
-  /* You need -jump to continue */
-  return 0;
+static void
+keep_journal(struct diskus_keep *keep, struct diskus_extent *e)
+{
+  if (e->from<e->to)
+    fprintf(keep->fd, "%c %lld-%lld\n", e->state, e->from, e->to-1);
 }
 
-static int
-check_worker(CFG, unsigned char *ptr, int len)
+static void
+keep_flush(struct diskus_keep *keep)
 {
-  int		i;
-  unsigned char	sect[MAX_SECTOR_SIZE];
+  keep_journal(keep, &keep->open);
+  fflush(keep->fd);
+  time(&keep->flushed);
+}
 
-  if (!ptr || len<0)
-    return 0;
+static struct diskus_keep *
+keep_open(const char *name)
+{
+  struct diskus_keep	*keep;
+  char			line[256];
+  int			lnr;
 
-  for (i=0; i<len; i+=SECTOR_SIZE, ptr+=SECTOR_SIZE, cfg->nr++)
+  keep		= tino_alloc0O(sizeof *keep);
+  keep->name	= name;
+  pthread_mutex_init(&keep->mutex, NULL);
+  if ((keep->fd=fopen(name, "a+"))==NULL)
+    {
+      TINO_ERR1("ETTDU134A %s: cannot open keep file", name);
+      return 0;
+    }
+  rewind(keep->fd);
+  for (lnr=1; fgets(line, sizeof line, keep->fd); lnr++)
     {
-      int	off;
-      char	*end;
-      long long	cmp, ts;
+      long long	from, to;
+      char	state;
 
-      if (cfg->expand)
-	cfg->errtype	= ERR_NONE;
-      if ((off=find_signature(cfg, ptr))<0)
-	{
-	  diskus_err(cfg, ERR_SIGNATURE_MISSING, diskus_ret_diff, "cannot find signature");
-	  dump_sect(cfg, i, ptr);
-	  continue;
-	}
-      end	= 0;
-      cmp	= strtoll((char *)(ptr+off+8), &end, 16);
-      if (!end || *end!=' ')
-	{
-	  diskus_err(cfg, ERR_SIGNATURE_INVALID1, diskus_ret_diff, "invalid signature(1)");
-	  dump_sect(cfg, i, ptr);
-	  continue;
-	}
-      ts	= strtoll(end+1, &end, 10);
-      if (!end || *end!=']')
-	{
-	  diskus_err(cfg, ERR_SIGNATURE_INVALID2, diskus_ret_diff, "invalid signature(2)");
-	  dump_sect(cfg, i, ptr);
-	  continue;
-	}
-      if (cmp!=cfg->nr)
+      if (line[0]=='#')
 	{
-	  int	wrong;
-
-	  create_sector(cmp, sect, (char *)(ptr+off), (end-(char *)ptr)-off+1);
-	  wrong	= memcmp(ptr, sect, SECTOR_SIZE);
-	  diskus_err(cfg, ERR_SIGNATURE_MISMATCH, diskus_ret_diff,
-		     "signature number mismatch (%lld), %s data, %s timestamp",
-		     cmp, (wrong ? "invalid" : "valid"), (ts==cfg->ts ? "good" : "wrong"));
-	  if (wrong)
-	    dump_sect(cfg, i, ptr);
+	  sscanf(line, "# gen ts %lld sign %d sector %d", &keep->ts, &keep->sign, &keep->ssz);
 	  continue;
 	}
-      if (ts!=cfg->ts && cfg->ts)
-	{
-	  diskus_log(cfg, "timestamp jumped from %lld to %lld\n", cfg->ts, ts);
-	  cfg->retflags	|= diskus_ret_old;
-	}
-      cfg->ts	= ts;
-      create_sector(cfg->nr, sect, (char *)(ptr+off), (end-(char *)ptr)-off+1);
-      if (memcmp(ptr, sect, SECTOR_SIZE))
+      if (line[0]=='\n')
+	continue;
+      if (sscanf(line, "%c %lld-%lld", &state, &from, &to)!=3 || !strchr(KEEP_STATES, state) || from<0 || to<from)
 	{
-	  diskus_err(cfg, ERR_DATA_MISMATCH, diskus_ret_diff, "data mismatch");
-	  continue;
+	  TINO_ERR2("ETTDU135A %s:%d: invalid line in keep file", name, lnr);
+	  return 0;
 	}
+      keep_put(keep, from, to+1, state);
     }
-  cfg->pos	+= len;
-  return 0;
+  if (lnr==1)
+    fprintf(keep->fd, "# DISKUS keep file, sector size %d\n", SECTOR_SIZE);
+  time(&keep->flushed);
+  return keep;
 }
 
+/* Rewrite the keep file from the map
+ */
 static int
-gen_worker(CFG, unsigned char *ptr, int len)
+keep_close(struct diskus_keep *keep)
 {
-  int		i;
-  char		id[64];
-
-  if (!ptr || len<0)
-    return 0;
+  char	*tmp;
+  FILE	*fd;
+  int	i, ret;
 
-  for (i=0; i<len; i+=SECTOR_SIZE, ptr+=SECTOR_SIZE)
+  keep_flush(keep);
+  tmp	= tino_allocO(strlen(keep->name)+5);
+  sprintf(tmp, "%s.tmp", keep->name);
+  if ((fd=fopen(tmp, "w"))==NULL)
     {
-      snprintf(id, sizeof id, "[DISKUS %016llx %lld]", cfg->nr, (long long)cfg->ts);
-      create_sector(cfg->nr, ptr, id, strlen(id));
-      cfg->nr++;
+      TINO_ERR1("ETTDU136A %s: cannot write", tmp);
+      return diskus_ret_param;
     }
-  cfg->pos	+= len;
+  fprintf(fd, "# DISKUS keep file, sector size %d\n", SECTOR_SIZE);
+  if (keep->ts)
+    fprintf(fd, "# gen ts %lld sign %d sector %d\n", keep->ts, keep->sign, keep->ssz);
+  for (i=0; i<keep->n; i++)
+    fprintf(fd, "%c %lld-%lld\n", keep->map[i].state, keep->map[i].from, keep->map[i].to-1);
+  ret	= fclose(fd);
+  if (ret || rename(tmp, keep->name))
+    {
+      TINO_ERR2("ETTDU136A %s: cannot replace %s", tmp, keep->name);
+      return diskus_ret_param;
+    }
+  fclose(keep->fd);
   return 0;
 }
 
-static int
-null_worker(CFG, unsigned char *ptr, int len)
+/* Mark the bytes [pos,end) with the given state.
+ *
+ * A Read error on a sector with a Write error (and vice versa)
+ * becomes E.
+ */
+static void
+keep_mark(CFG, long long pos, long long end, char state)
 {
-  static size_t	flag;
+  struct diskus_keep	*keep=cfg->keep;
+  long long		from, to;
 
-  if (len<0)
-    return 0;
-  if (!ptr)
+  if (!keep)
+    return;
+  from	= pos/SECTOR_SIZE;
+  to	= (end+SECTOR_SIZE-1)/SECTOR_SIZE;
+  if (from>=to)
+    return;
+
+  pthread_mutex_lock(&keep->mutex);
+  if (state=='R' || state=='W')
     {
-      flag	= 0;
-      return 0;
+      char	old=keep_get(keep, from);
+
+      if (old=='E' || (old!=state && (old=='R' || old=='W')))
+	state	= 'E';
     }
-  if (flag!=len)
+  keep_put(keep, from, to, state);
+
+  if (keep->open.state!=state || keep->open.to!=from)
     {
-      memset(ptr, 0, len);
-      flag	= len;
+      keep_journal(keep, &keep->open);
+      keep->open.from	= from;
+      keep->open.state	= state;
     }
-  cfg->pos	+= len;
-  cfg->nr	+= len/SECTOR_SIZE;
-  return 0;
+  keep->open.to	= to;
+  if (time(NULL)-keep->flushed>=KEEP_FLUSH)
+    keep_flush(keep);
+  pthread_mutex_unlock(&keep->mutex);
 }
 
-static int
-backoff(CFG)
+/* Parse a position with suffix like option -start
+ */
+static long long
+parse_pos(const char *s, char **end)
 {
-  unsigned long long	jump;
-
-  /* Keep it at a power of 2
-   */
-  for (jump=SKIP_BYTES; jump>cfg->bs; jump>>=1);
+  long long	n;
 
-  switch (cfg->jump)
+  n	= strtoll(s, end, 10);
+  switch (**end)
     {
-    default:
-      return 1;
-
-    case 1:
-      cfg->skip	= jump;
-      break;
-    case 2:
-      if (cfg->nxt!=cfg->pos)
-	cfg->skip	= 0;
-      cfg->skip	+= jump;
-      break;
-    case 3:
-      if (cfg->nxt==cfg->pos || !cfg->skip)
-	cfg->skip	+= jump;
-      break;
-    case 4:
-      if (cfg->nxt!=cfg->pos || !cfg->skip)
-	cfg->skip = jump/2;
-      cfg->skip	*= 2;
-      break;
-    case 5:
-      if (!cfg->skip)
-	cfg->skip	= jump;
-      else if (cfg->nxt==cfg->pos)
-	cfg->skip	*= 2;
-      break;
+    default:	return n;
+    case 'B':	break;
+    case 'S':	n	*= 512;		break;
+    case 'C':	n	*= 4096;	break;
+    case 'K':	n	<<= 10;		break;
+    case 'M':	n	<<= 20;		break;
+    case 'G':	n	<<= 30;		break;
+    case 'T':	n	<<= 40;		break;
+    case 'P':	n	<<= 50;		break;
+    case 'E':	n	<<= 60;		break;
     }
-  cfg->nxt	= (cfg->pos+cfg->skip)& ~(unsigned long long)(jump-1);
-  return 0;
+  (*end)++;
+  return n;
 }
 
+/* Option -update: Letter[From][-To]..
+ *
+ * Returns the number of byte ranges within [pos,end) (end 0 is open)
+ * which need to be processed, the ranges are from/to pairs in *ranges.
+ * Without -update this is everything still 'M'issing, that is, the
+ * run is resumed.  Returns -1 if -update cannot be parsed.
+ */
 static int
-run_read_type(CFG, int mode, int flags, diskus_worker_fn worker)
+keep_todo(CFG, long long pos, long long end, long long **ranges)
 {
-  int	got;
-  void	*block;
+  struct diskus_keep	*keep=cfg->keep;
+  const char		*s;
+  long long		*r;
+  int			n, max;
 
-  if ((cfg->fd=tino_file_openE(cfg->name, mode|(cfg->async ? 0 : flags)))<0)
-    {
-      TINO_ERR1("ETTDU100A %s: cannot open", cfg->name);
-      return diskus_ret_param;
-    }
-  block	= tino_alloc_alignedO(cfg->bs);
-  if (tino_file_read_allE(cfg->fd, block, cfg->bs)<0)
+  n	= 0;
+  max	= 16;
+  r	= tino_allocO(max * sizeof *r);
+  *ranges	= r;
+  s	= cfg->update ? cfg->update : "M";
+  while (*s)
     {
-      tino_file_closeE(cfg->fd);
-      if ((cfg->fd=tino_file_openE(cfg->name, mode|(cfg->async ? flags : 0)))<0)
+      char		sel[sizeof KEEP_STATES+3];	/* 'A' may add 3 at the end	*/
+      long long		from, to, sect;
+      int		i;
+      char		*e;
+
+      for (i=0; isalpha((unsigned char)*s); s++)
 	{
-	  TINO_ERR1("ETTDU100A %s: cannot open", cfg->name);
-	  return diskus_ret_param;
+	  if (*s=='A')
+	    sel[i++]	= 'R', sel[i++] = 'W', sel[i++] = 'E';
+	  else if (!strchr(KEEP_STATES, *s))
+	    break;
+	  else
+	    sel[i++]	= *s;
+	  if (i>=sizeof KEEP_STATES)
+	    break;
 	}
-      if (!cfg->quiet)
-	TINO_ERR1("WTTDU108 %s: opened with reverse option -async", cfg->name);
-    }
-  if (worker(cfg, NULL, 1))
-    {
-      TINO_ERR1("FTTDU113A %s: internal fatal error, worker could not be initialized", cfg->name);
-      return diskus_ret_param;
-    }
-
-  while (!cfg->endpos || cfg->pos<cfg->endpos)
-    {
-      xDP(("() pos=%llu", cfg->pos));
-
-      if (SECTOR_OFFSET(cfg->pos))
+      sel[i]	= 0;
+      if (!i)
 	{
-	  TINO_ERR2("FTTDU112A %s: internal fatal error, pos %lld not multiple of sector size", cfg->name, cfg->pos);
-	  return diskus_ret_param;
+	  TINO_ERR1("ETTDU137F -update: expected state letter at: %s", s);
+	  return -1;
 	}
-
-      /* Repositioning is *required* here, as the position is unknown
-       * here
-       */
-      cfg->nr	= cfg->pos/(unsigned long long)SECTOR_SIZE;
-      if (tino_file_lseekE(cfg->fd, cfg->pos, SEEK_SET)!=cfg->pos)
+      from	= pos;
+      to	= end;
+      if (isdigit((unsigned char)*s))
 	{
-	  TINO_ERR2("ETTDU106E %s: cannot seek to %lld", cfg->name, cfg->pos);
-	  return diskus_ret_seek;
+	  from	= parse_pos(s, &e) & ~(long long)(SECTOR_SIZE-1);
+	  s	= e;
+	  if (from<pos)
+	    from	= pos;
 	}
-
-      for (;;)
+      if (*s=='-')
 	{
-	  long long	want;
-	  int		max;
+	  to	= parse_pos(s+1, &e) & ~(long long)(SECTOR_SIZE-1);
+	  s	= e;
+	  if (end && to>end)
+	    to	= end;
+	}
+      if (*s==',')
+	s++;
 
-	  max	= cfg->bs;
-	  if (cfg->endpos && cfg->pos+max>cfg->endpos)
-	    max	= cfg->endpos-cfg->pos;
+      /* walk the map, gaps are 'M'	*/
+      pthread_mutex_lock(&keep->mutex);
+      for (sect=from/SECTOR_SIZE; !to || sect*SECTOR_SIZE<to; )
+	{
+	  long long	next;
+	  char		state;
+
+	  i	= keep_find(keep, sect);
+	  if (i<keep->n && keep->map[i].from<=sect)
+	    {
+	      state	= keep->map[i].state;
+	      next	= keep->map[i].to;
+	    }
+	  else
+	    {
+	      state	= 'M';
+	      next	= i<keep->n ? keep->map[i].from : -1;
+	    }
+	  if (strchr(sel, state))
+	    {
+	      long long	a, b;
+
+	      a	= sect*SECTOR_SIZE;
+	      b	= next<0 ? to : next*SECTOR_SIZE;
+	      if (to && b>to)
+		b	= to;
+	      if (n && r[n-1]==a)
+		r[n-1]	= b;
+	      else
+		{
+		  if (n+2>max)
+		    r	= tino_reallocO(r, (max*=2) * sizeof *r);
+		  r[n++]	= a;
+		  r[n++]	= b;
+		}
+	    }
+	  if (next<0)
+	    break;
+	  sect	= next;
+	}
+      pthread_mutex_unlock(&keep->mutex);
+      if (*s && !isalpha((unsigned char)*s))
+	{
+	  TINO_ERR1("ETTDU137F -update: cannot parse: %s", s);
+	  return -1;
+	}
+    }
+  *ranges	= r;
+  return n/2;
+}
+
+static void
+diskus_vlog(CFG, int sync, TINO_VA_LIST list)
+{
+  pthread_mutex_lock(&diskus_out);
+  if (diskus_njobs>1)
+    tino_data_printfA(cfg->out, "%s: ", cfg->label);
+  tino_data_printfA(cfg->out, "sector %llu: ", cfg->nr);
+  tino_data_vsprintfA(cfg->out, list);
+  tino_data_printfA(cfg->out, "\n");
+  if (sync)
+    tino_data_syncA(cfg->out, 0);
+  pthread_mutex_unlock(&diskus_out);
+}
+
+static void
+diskus_log(CFG, const char *text, ...)
+{
+  tino_va_list	list;
+
+  tino_va_start(list, text);
+  diskus_vlog(cfg, 1, &list);
+  tino_va_end(list);
+}
+
+/* Error ranges
+ *
+ * Adjacent errors of the same type are merged into one range, which
+ * is reported when it closes: On the next error elsewhere, when the
+ * scan has left it, at the end, or every RANGE_FLUSH seconds.  Only
+ * the first error of a range is printed (all with -expand), the
+ * details of each error go to the -errfile sidecar.
+ */
+#define	RANGE_FLUSH	10	/* seconds	*/
+
+static void
+range_close(CFG)
+{
+  if (!cfg->rcount)
+    return;
+  pthread_mutex_lock(&diskus_out);
+  if (cfg->rcount>1 || cfg->rto-cfg->rfrom>1)
+    {
+      if (diskus_njobs>1)
+	tino_data_printfA(cfg->out, "%s: ", cfg->label);
+      tino_data_printfA(cfg->out, "sector %llu: %d %s errors up to sector %llu\n", cfg->rfrom, cfg->rcount, diskus_errnames[cfg->rtype], cfg->rto-1);
+    }
+  tino_data_syncA(cfg->out, 0);
+  pthread_mutex_unlock(&diskus_out);
+  json_error(cfg, cfg->rtype, cfg->rfrom, cfg->rto, cfg->rcount);
+  cfg->rcount	= 0;
+}
+
+/* Returns 1 if this opens a new range
+ */
+static int
+range_add(CFG, int err, long long from, long long to)
+{
+  if (cfg->rcount && cfg->rtype==err && from>=cfg->rfrom && from<=cfg->rto
+      && time(NULL)-cfg->rstart<RANGE_FLUSH)
+    {
+      if (cfg->rto<to)
+	cfg->rto	= to;
+      cfg->rcount++;
+      return 0;
+    }
+  range_close(cfg);
+  cfg->rfrom	= from;
+  cfg->rto	= to;
+  cfg->rtype	= err;
+  cfg->rcount	= 1;
+  cfg->rstart	= time(NULL);
+  return 1;
+}
+
+/* Binary sidecar for -errfile, little endian records of
+ * ERRFILE_REC bytes: sector (8), sectors (4), type (1), device (1),
+ * 2 bytes reserved.  The file starts with ERRFILE_MAGIC.  Sectors are
+ * always 512 bytes here, regardless of -sector.
+ */
+#define	ERRFILE_MAGIC	"DISKUSE1"
+#define	ERRFILE_REC	16
+
+static void
+errfile_put(CFG, int err, long long from, long long n)
+{
+  unsigned char	rec[ERRFILE_REC];
+  int		i;
+
+  if (!diskus_errfile)
+    return;
+  from	*= cfg->ssz/SECTOR_SIZE;
+  n	*= cfg->ssz/SECTOR_SIZE;
+  for (i=0; i<8; i++)
+    rec[i]	= from>>(8*i);
+  for (i=0; i<4; i++)
+    rec[8+i]	= n>>(8*i);
+  rec[12]	= err;
+  rec[13]	= cfg->dev;
+  rec[14]	= 0;
+  rec[15]	= 0;
+  pthread_mutex_lock(&diskus_out);
+  fwrite(rec, sizeof rec, 1, diskus_errfile);
+  pthread_mutex_unlock(&diskus_out);
+}
+
+static void
+diskus_err(CFG, enum diskus_errtype err, int retflag, const char *text, ...)
+{
+  tino_va_list	list;
+  long long	to;
+
+  xDP(("(%p, %d, %d, %s, ..)", cfg, err, retflag, text));
+
+  to	= err==ERR_READ && cfg->nxt>cfg->pos ? cfg->nxt/cfg->ssz : cfg->nr+1;
+  errfile_put(cfg, err, cfg->nr, to-cfg->nr);
+  if (range_add(cfg, err, cfg->nr, to) || cfg->expand)
+    {
+      tino_va_start(list, text);
+      diskus_vlog(cfg, 0, &list);
+      tino_va_end(list);
+    }
+
+  if (err!=ERR_READ)
+    keep_mark(cfg, cfg->nr*cfg->ssz, (cfg->nr+1)*cfg->ssz, err==ERR_PATCHED ? 'N' : 'O');
+  if (!cfg->err)
+    cfg->firsterr	= cfg->nr;
+  cfg->lasterr	= cfg->nr;
+  cfg->errtype	=  err;
+  cfg->retflags	|= retflag;
+  cfg->err++;
+}
+
+/* This requires repositioning like it is done in run_read_type()
+ */
+static int
+patch_worker(CFG, unsigned char *ptr, int len)
+{
+  int		put;
+  size_t	all;
+
+  if (!ptr)
+    return 0;
+  if (len>=0)
+    {
+      /* Just update counters	*/
+      cfg->pos	+= len;
+      cfg->nr	+= len/cfg->ssz;
+      return 0;
+    }
+
+  all = -len;
+  if (all!=cfg->cur)
+    {
+      TINO_ERR1("ETTDU111F incomplete block to write: %d", all);
+      return diskus_ret_param;
+    }
+  if (all&(all-1))
+    {
+      TINO_ERR1("ETTDU112F blocksize not power of 2: %d", all);
+      return diskus_ret_param;
+    }
+  if (all<512 || all>65536)
+    {
+      TINO_ERR1("ETTDU113F unsupported blocksize: must be 512 to 64K: %d", all);
+      return diskus_ret_param;
+    }
+  if (cfg->pos&(all-1))
+    {
+      TINO_ERR2("ETTDU114F %s: attempt to seek to non sector boundary %lld", cfg->name, cfg->pos);
+      return diskus_ret_seek;
+    }
+  if (tino_file_lseekE(cfg->fd, cfg->pos, SEEK_SET)!=cfg->pos)
+    {
+      TINO_ERR2("ETTDU106E %s: cannot seek to %lld", cfg->name, cfg->pos);
+      return diskus_ret_seek;
+    }
+  memset(ptr, 0, all);
+  put	= tino_file_writeE(cfg->fd, ptr, all);
+  if (put<0)
+    {
+      TINO_ERR3("ETTDU105A %s: write error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
+      return diskus_ret_write;
+    }
+  if (put!=all)
+    TINO_ERR5("WTTDU123A %s: short write: %d instead of %d at pos=%lld (now %lld)", cfg->name, put, all, cfg->pos, cfg->pos+put);
+  else
+    {
+      diskus_err(cfg, ERR_PATCHED, diskus_ret_read, "patched");
+      keep_mark(cfg, cfg->pos, cfg->pos+all, 'N');
+    }
+
+  /* You need -jump to continue */
+  return 0;
+}
+
+/* Worker thread pool for the sector kernels
+ *
+ * A block is cut into -threads slices of whole sectors, which are
+ * processed in parallel.  The calling thread does the first slice
+ * itself and waits for the others, so the results are in place for
+ * the (single threaded) worker afterwards.
+ */
+struct diskus_sect
+  {
+    signed char		err;		/* enum diskus_errtype	*/
+    char		wrong;		/* ERR_SIGNATURE_MISMATCH: data invalid, too	*/
+    short		at;		/* first wrong byte	*/
+    long long		cmp, ts;	/* from the signature	*/
+  };
+
+typedef void	diskus_kernel_fn(CFG, unsigned char *, long long nr, int n, struct diskus_sect *);
+
+/* Instantiate kernel fn(cfg, ptr, nr, n, res, ssz) for 512 and 4096
+ * byte sectors, where the sector loops have constant bounds, and for
+ * any other sector size.  SECTOR_KERNEL() picks the right one.
+ */
+#define	SECTOR_KERNELS(fn)	\
+  static void fn##_512(CFG, unsigned char *ptr, long long nr, int n, struct diskus_sect *res) { fn(cfg, ptr, nr, n, res, 512); }	\
+  static void fn##_4k(CFG, unsigned char *ptr, long long nr, int n, struct diskus_sect *res) { fn(cfg, ptr, nr, n, res, 4096); }	\
+  static void fn##_any(CFG, unsigned char *ptr, long long nr, int n, struct diskus_sect *res) { fn(cfg, ptr, nr, n, res, cfg->ssz); }
+#define	SECTOR_KERNEL(fn)	(cfg->ssz==512 ? fn##_512 : cfg->ssz==4096 ? fn##_4k : fn##_any)
+
+struct diskus_pool
+  {
+    struct diskus_cfg	*cfg;
+    int			n, gen, busy;
+    pthread_mutex_t	mutex;
+    pthread_cond_t	go, done;
+    pthread_t		*tid;
+    /* the job	*/
+    diskus_kernel_fn	*fn;
+    unsigned char	*ptr;
+    long long		nr;
+    int			cnt;
+    struct diskus_sect	*res;
+    int			max;		/* allocated res	*/
+  };
+
+static void
+pool_slice(struct diskus_pool *pool, int k)
+{
+  int	from, to;
+
+  from	= (long long)pool->cnt*k/pool->n;
+  to	= (long long)pool->cnt*(k+1)/pool->n;
+  if (from<to)
+    pool->fn(pool->cfg, pool->ptr+from*pool->cfg->ssz, pool->nr+from, to-from, pool->res+from);
+}
+
+static void *
+pool_thread(void *arg)
+{
+  struct diskus_pool	*pool=arg;
+  int			k, gen;
+
+  pthread_mutex_lock(&pool->mutex);
+  k	= ++pool->busy;		/* slice number, 0 is the caller	*/
+  gen	= pool->gen;
+  pthread_cond_signal(&pool->done);
+  for (;;)
+    {
+      while (pool->gen==gen)
+	pthread_cond_wait(&pool->go, &pool->mutex);
+      gen	= pool->gen;
+      pthread_mutex_unlock(&pool->mutex);
+
+      pool_slice(pool, k);
+
+      pthread_mutex_lock(&pool->mutex);
+      if (!--pool->busy)
+	pthread_cond_signal(&pool->done);
+    }
+  return NULL;
+}
+
+static struct diskus_sect *
+pool_res(CFG, int cnt)
+{
+  struct diskus_pool	*pool=cfg->pool;
+
+  if (!pool)
+    {
+      pool		= tino_alloc0O(sizeof *pool);
+      cfg->pool		= pool;
+      pool->cfg		= cfg;
+      pool->n		= 1;
+      pthread_mutex_init(&pool->mutex, NULL);
+      pthread_cond_init(&pool->go, NULL);
+      pthread_cond_init(&pool->done, NULL);
+      if (cfg->threads>1)
+	{
+	  pool->tid	= tino_alloc0O(cfg->threads * sizeof *pool->tid);
+	  pthread_mutex_lock(&pool->mutex);
+	  for (; pool->n<cfg->threads; pool->n++)
+	    if (pthread_create(&pool->tid[pool->n], NULL, pool_thread, pool))
+	      {
+		TINO_ERR2("WTTDU130 %s: could only start %d threads", cfg->name, pool->n);
+		break;
+	      }
+	  while (pool->busy<pool->n-1)
+	    pthread_cond_wait(&pool->done, &pool->mutex);
+	  pool->busy	= 0;
+	  pthread_mutex_unlock(&pool->mutex);
+	}
+    }
+  if (pool->max<cnt)
+    {
+      pool->res	= tino_reallocO(pool->res, cnt * sizeof *pool->res);
+      pool->max	= cnt;
+    }
+  return pool->res;
+}
+
+/* Run fn on the n sectors of ptr, which start at sector nr.
+ * Returns the per sector results.
+ */
+static struct diskus_sect *
+pool_run(CFG, diskus_kernel_fn *fn, unsigned char *ptr, long long nr, int cnt)
+{
+  struct diskus_pool	*pool;
+
+  pool_res(cfg, cnt);
+  pool		= cfg->pool;
+  pool->fn	= fn;
+  pool->ptr	= ptr;
+  pool->nr	= nr;
+  pool->cnt	= cnt;
+  if (pool->n<2 || cnt<2*pool->n)
+    {
+      fn(cfg, ptr, nr, cnt, pool->res);
+      return pool->res;
+    }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->busy	= pool->n-1;
+  pool->gen++;
+  pthread_cond_broadcast(&pool->go);
+  pthread_mutex_unlock(&pool->mutex);
+
+  pool_slice(pool, 0);
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->busy)
+    pthread_cond_wait(&pool->done, &pool->mutex);
+  pthread_mutex_unlock(&pool->mutex);
+  return pool->res;
+}
+
+/* The part of check_worker() which does not depend on the sectors
+ * before, such that it can run in parallel.
+ */
+__attribute__((always_inline))
+static inline void
+check_kernel(CFG, unsigned char *ptr, long long nr, int n, struct diskus_sect *res, const int ssz)
+{
+  for (; --n>=0; ptr+=ssz, nr++, res++)
+    {
+      int		off, sign, len;
+      char		*end;
+      unsigned char	pat[16];
+
+      res->wrong	= 0;
+      if ((off=find_signature(cfg, ptr, nr, ssz))<0)
+	{
+	  res->err	= ERR_SIGNATURE_MISSING;
+	  continue;
+	}
+      sign	= ptr[off+7]=='2' ? 2 : 1;
+      end	= 0;
+      res->cmp	= strtoll((char *)(ptr+off+6+sign), &end, 16);
+      if (!end || *end!=' ')
+	{
+	  res->err	= ERR_SIGNATURE_INVALID1;
+	  continue;
+	}
+      res->ts	= strtoll(end+1, &end, 10);
+      if (!end || *end!=']')
+	{
+	  res->err	= ERR_SIGNATURE_INVALID2;
+	  continue;
+	}
+      len	= (end-(char *)ptr)-off+1;
+      sector_pat(pat, sign, res->cmp, res->ts, (char *)(ptr+off), len);
+      res->at	= compare_sector(res->cmp, ptr, pat, (char *)(ptr+off), len, ssz);
+      res->wrong	= res->at>=0;
+      res->err	= res->cmp!=nr ? ERR_SIGNATURE_MISMATCH : res->wrong ? ERR_DATA_MISMATCH : ERR_NONE;
+    }
+}
+SECTOR_KERNELS(check_kernel)
+
+static int
+check_worker(CFG, unsigned char *ptr, int len)
+{
+  int			i;
+  struct diskus_sect	*res;
+
+  if (!ptr || len<0)
+    return 0;
+
+  sector_predict(cfg);
+  res	= pool_run(cfg, SECTOR_KERNEL(check_kernel), ptr, cfg->nr, len/cfg->ssz);
+  for (i=0; i<len; i+=cfg->ssz, ptr+=cfg->ssz, cfg->nr++, res++)
+    {
+      if (cfg->expand)
+	cfg->errtype	= ERR_NONE;
+      switch (res->err)
+	{
+	case ERR_SIGNATURE_MISSING:
+	  diskus_err(cfg, ERR_SIGNATURE_MISSING, diskus_ret_diff, "cannot find signature");
+	  dump_sect(cfg, i, ptr);
+	  continue;
+
+	case ERR_SIGNATURE_INVALID1:
+	  diskus_err(cfg, ERR_SIGNATURE_INVALID1, diskus_ret_diff, "invalid signature(1)");
+	  dump_sect(cfg, i, ptr);
+	  continue;
+
+	case ERR_SIGNATURE_INVALID2:
+	  diskus_err(cfg, ERR_SIGNATURE_INVALID2, diskus_ret_diff, "invalid signature(2)");
+	  dump_sect(cfg, i, ptr);
+	  continue;
+
+	case ERR_SIGNATURE_MISMATCH:
+	  diskus_err(cfg, ERR_SIGNATURE_MISMATCH, diskus_ret_diff,
+		     "signature number mismatch (%lld), %s data, %s timestamp",
+		     res->cmp, (res->wrong ? "invalid" : "valid"), (res->ts==cfg->ts ? "good" : "wrong"));
+	  if (res->wrong)
+	    dump_sect(cfg, i, ptr);
+	  continue;
+	}
+      if (res->ts!=cfg->ts && cfg->fresh)
+	{
+	  diskus_err(cfg, ERR_STALE, diskus_ret_diff, "stale sector, timestamp %lld instead of %lld", res->ts, cfg->ts);
+	  continue;
+	}
+      if (res->ts!=cfg->ts && cfg->ts)
+	{
+	  diskus_log(cfg, "timestamp jumped from %lld to %lld\n", cfg->ts, res->ts);
+	  cfg->retflags	|= diskus_ret_old;
+	}
+      cfg->ts	= res->ts;
+      if (res->err==ERR_DATA_MISMATCH)
+	{
+	  diskus_err(cfg, ERR_DATA_MISMATCH, diskus_ret_diff, "data mismatch at byte %d", res->at);
+	  continue;
+	}
+    }
+  cfg->pos	+= len;
+  return 0;
+}
+
+__attribute__((always_inline))
+static inline void
+gen_kernel(CFG, unsigned char *ptr, long long nr, int n, struct diskus_sect *res, const int ssz)
+{
+  char		id[64];
+  unsigned char	pat[16];
+  int		len;
+
+  for (; --n>=0; ptr+=ssz, nr++)
+    {
+      len	= sector_id(id, sizeof id, cfg->sign, nr, cfg->ts);
+      sector_pat(pat, cfg->sign, nr, cfg->ts, id, len);
+      create_sector(nr, ptr, pat, id, len, ssz);
+    }
+}
+SECTOR_KERNELS(gen_kernel)
+
+static int
+gen_worker(CFG, unsigned char *ptr, int len)
+{
+  if (!ptr || len<0)
+    return 0;
+
+  pool_run(cfg, SECTOR_KERNEL(gen_kernel), ptr, cfg->nr, len/cfg->ssz);
+  cfg->nr	+= len/cfg->ssz;
+  cfg->pos	+= len;
+  return 0;
+}
+
+/* io_open() hands out zeroed blocks, so this only has to clear
+ * anything if the block was used for something else before.
+ */
+static int
+null_worker(CFG, unsigned char *ptr, int len)
+{
+  if (len<0)
+    return 0;
+  if (!ptr)
+    {
+      cfg->nulled	= 0;
+      return 0;
+    }
+  if (cfg->nulled!=len)
+    {
+      memset(ptr, 0, len);
+      cfg->nulled	= len;
+    }
+  cfg->pos	+= len;
+  cfg->nr	+= len/cfg->ssz;
+  return 0;
+}
+
+static int
+backoff(CFG)
+{
+  unsigned long long	jump;
+
+  /* Keep it at a power of 2
+   */
+  for (jump=SKIP_BYTES; jump>cfg->bs; jump>>=1);
+
+  switch (cfg->jump)
+    {
+    default:
+      return 1;
+
+    case 1:
+      cfg->skip	= jump;
+      break;
+    case 2:
+      if (cfg->nxt!=cfg->pos)
+	cfg->skip	= 0;
+      cfg->skip	+= jump;
+      break;
+    case 3:
+      if (cfg->nxt==cfg->pos || !cfg->skip)
+	cfg->skip	+= jump;
+      break;
+    case 4:
+      if (cfg->nxt!=cfg->pos || !cfg->skip)
+	cfg->skip = jump/2;
+      cfg->skip	*= 2;
+      break;
+    case 5:
+      if (!cfg->skip)
+	cfg->skip	= jump;
+      else if (cfg->nxt==cfg->pos)
+	cfg->skip	*= 2;
+      break;
+    }
+  cfg->nxt	= (cfg->pos+cfg->skip)& ~(unsigned long long)(jump-1);
+  return 0;
+}
+
+/* Access patterns for option -walk
+ *
+ * The region is cut into blocks of -bs, and the walk is a permutation
+ * of the block numbers.  Each walk is a bijection on a domain of
+ * walkdom >= walkn steps, steps which map outside the region are
+ * skipped.  So there is full coverage with O(1) memory.
+ */
+enum
+  {
+    WALK_SEQ	= 0,	/* classic sequential loop	*/
+    WALK_RANDOM,	/* Feistel permutation	*/
+    WALK_STRIDE,	/* every walkarg'th block, then the next offset	*/
+    WALK_BUTTERFLY,	/* alternating from both ends to the middle	*/
+  };
+
+static int
+walk_parse(CFG, const char *s)
+{
+  char	*end;
+
+  cfg->walkarg	= 0;
+  cfg->seed	= 0;
+  if (!strcmp(s, "seq"))
+    cfg->walk	= WALK_SEQ;
+  else if (!strcmp(s, "butterfly"))
+    cfg->walk	= WALK_BUTTERFLY;
+  else if (!strcmp(s, "random"))
+    cfg->walk	= WALK_RANDOM;
+  else if (!strncmp(s, "random:", 7))
+    {
+      cfg->walk	= WALK_RANDOM;
+      cfg->seed	= strtoull(s+7, &end, 0);
+      if (end==s+7 || *end)
+	return -1;
+    }
+  else if (!strncmp(s, "stride:", 7))
+    {
+      cfg->walk		= WALK_STRIDE;
+      cfg->walkarg	= strtol(s+7, &end, 0);
+      if (end==s+7 || *end || cfg->walkarg<1)
+	return -1;
+    }
+  else
+    return -1;
+  return 0;
+}
+
+/* Returns -1 if the region is unknown
+ */
+static int
+walk_setup(CFG)
+{
+  cfg->walkfrom	= cfg->pos;
+  cfg->walkto	= cfg->endpos ? cfg->endpos : cfg->size;
+  if (cfg->walkto<=cfg->walkfrom)
+    return -1;
+  cfg->walkn	= (cfg->walkto-cfg->walkfrom+cfg->bs-1)/cfg->bs;
+  cfg->walkdom	= cfg->walkn;
+  switch (cfg->walk)
+    {
+    case WALK_RANDOM:
+      for (cfg->walkbits=1; (1ll<<(2*cfg->walkbits))<cfg->walkn; cfg->walkbits++);
+      cfg->walkdom	= 1ll<<(2*cfg->walkbits);
+      if (!cfg->seed)
+	cfg->seed	= sector_mix(time(NULL));
+      break;
+    case WALK_STRIDE:
+      cfg->walkdom	= (cfg->walkn+cfg->walkarg-1)/cfg->walkarg*cfg->walkarg;
+      break;
+    }
+  return 0;
+}
+
+/* Position of walk step t, -1 if outside of the region
+ */
+static long long
+walk_pos(CFG, long long t)
+{
+  unsigned long long	b, m, l, r, x;
+  int			i;
+
+  switch (cfg->walk)
+    {
+    default:
+      b	= t;
+      break;
+
+    case WALK_RANDOM:
+      m	= (1ull<<cfg->walkbits)-1;
+      l	= t>>cfg->walkbits;
+      r	= t&m;
+      for (i=0; i<4; i++)
+	{
+	  x	= l ^ (sector_mix(r ^ cfg->seed ^ (unsigned long long)i<<56) & m);
+	  l	= r;
+	  r	= x;
+	}
+      b	= l<<cfg->walkbits | r;
+      break;
+
+    case WALK_STRIDE:
+      m	= cfg->walkdom/cfg->walkarg;
+      b	= t%m*cfg->walkarg + t/m;
+      break;
+
+    case WALK_BUTTERFLY:
+      b	= t&1 ? cfg->walkn-1-t/2 : t/2;
+      break;
+    }
+  return b<cfg->walkn ? cfg->walkfrom+(long long)b*cfg->bs : -1;
+}
+
+/* I/O queue
+ *
+ * The run_*() loops below do not call read()/write() directly, they
+ * go through a queue of cfg->qd aligned blocks.  Requests are issued
+ * ahead of the current position and may complete in any order, but
+ * io_read() always hands out the blocks in ascending position, such
+ * that the workers see exactly the same sequence as before.
+ *
+ * The "sync" engine is the classic one-block-at-a-time loop (qd 1).
+ */
+
+enum
+  {
+    SLOT_FREE	= 0,
+    SLOT_BUSY,		/* request in flight	*/
+    SLOT_DONE,		/* request completed, res is valid	*/
+    SLOT_USED,		/* block handed out to the worker	*/
+  };
+
+struct diskus_slot
+  {
+    unsigned char	*buf;		/* aligned block owned by the slot	*/
+    unsigned char	*ptr;		/* data to transfer, usually buf	*/
+    long long		pos;
+    int			len, res;
+    int			state;
+    long long		t0;		/* usec when queued	*/
+    long long		step;		/* -walk step after this one	*/
+#ifdef DISKUS_URING
+    struct iovec	iov;
+#endif
+#ifdef DISKUS_AIO
+    struct iocb		iocb;
+#endif
+  };
+
+struct diskus_engine
+  {
+    const char	*name;
+    int		(*setup)(CFG);		/* 0 if engine is usable	*/
+    int		(*submit)(CFG, struct diskus_slot *);
+    int		(*reap)(CFG, int wait);	/* wait for at least one completion if wait	*/
+    void	(*exit)(CFG);
+  };
+
+struct diskus_io
+  {
+    const struct diskus_engine	*e;
+    int			qd, write;
+    struct diskus_slot	*slot;
+    int			head, cnt;	/* oldest slot and number of slots not free	*/
+    long long		next;		/* position of the next request	*/
+    long long		step;		/* next -walk step	*/
+    /* First failed write	*/
+    int			failed, failput, failerr;
+    long long		failpos;
+#ifdef DISKUS_URING
+    int			ring, pending;
+    void		*sqmap, *cqmap;
+    size_t		sqlen, cqlen, sqelen;
+    struct io_uring_sqe	*sqe;
+    unsigned		*sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned		*cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe	*cqe;
+#endif
+#ifdef DISKUS_AIO
+    aio_context_t	ctx;
+    struct iocb		**iocbs;
+    struct io_event	*events;
+    int			npend;
+#endif
+#ifdef DISKUS_VERIFY
+    int			nsid, lbs;	/* NVMe namespace (0: SCSI), LBA size	*/
+    long long		start, size;	/* partition offset and size	*/
+#endif
+    int			abort;		/* failure which is no bad block	*/
+  };
+
+/* Called by the engines when a request completes.
+ *
+ * Blocks are not cleared before each read.  Only after a short or
+ * failed read the rest is cleared, so nothing of the block before
+ * can show up as data.
+ */
+static void
+io_done(CFG, struct diskus_slot *slot, int res)
+{
+  long long	usec;
+
+  if (!cfg->io->write && res<slot->len)
+    memset(slot->ptr+(res>0 ? res : 0), 0, slot->len-(res>0 ? res : 0));
+  slot->res	= res;
+  slot->state	= SLOT_DONE;
+  if (!res)			/* EOF is no I/O	*/
+    return;
+  usec		= diskus_usec()-slot->t0;
+  stats_add(cfg, res>0 ? res : 0, usec);
+  zone_add(cfg, slot->pos, usec);
+}
+
+static int
+sync_setup(CFG)
+{
+  cfg->io->qd	= 1;
+  return 0;
+}
+
+/* Blocking I/O at the current file position.
+ *
+ * run_read_type() and run_write() take care that the file position
+ * matches slot->pos.
+ */
+static int
+sync_submit(CFG, struct diskus_slot *slot)
+{
+  /* XXX bug alert.  tino_file_write_allE() may behave erratic on
+   * some POSIX systems on EINTR.  However it works on Linux.
+   */
+  int	res;
+
+  if (cfg->walk && tino_file_lseekE(cfg->fd, slot->pos, SEEK_SET)!=slot->pos)
+    {
+      io_done(cfg, slot, -errno);
+      return 0;
+    }
+  errno	= 0;
+  if (cfg->io->write)
+    {
+      /* A short count is the end of the device (ENOSPC or nothing
+       * written), anything else is a write error.
+       */
+      res	= tino_file_write_allE(cfg->fd, slot->ptr, slot->len);
+      if (res<slot->len && errno && errno!=ENOSPC)
+	res	= -1;
+    }
+  else
+    res	= tino_file_readE(cfg->fd, slot->ptr, slot->len);
+  io_done(cfg, slot, res<0 ? -errno : res);
+  return 0;
+}
+
+static int
+sync_reap(CFG, int wait)
+{
+  return 0;
+}
+
+static void
+sync_exit(CFG)
+{
+}
+
+static const struct diskus_engine	engine_sync =
+  { "sync", sync_setup, sync_submit, sync_reap, sync_exit };
+
+#ifdef DISKUS_URING
+/* io_uring without liburing, the kernel ABI is stable enough.
+ *
+ * READV/WRITEV are used, as they are available since the first
+ * io_uring kernel (5.1).
+ */
+static void
+uring_unmap(struct diskus_io *io)
+{
+  if (io->sqe!=MAP_FAILED)
+    munmap(io->sqe, io->sqelen);
+  if (io->cqmap!=MAP_FAILED && io->cqmap!=io->sqmap)
+    munmap(io->cqmap, io->cqlen);
+  if (io->sqmap!=MAP_FAILED)
+    munmap(io->sqmap, io->sqlen);
+  close(io->ring);
+}
+
+static int
+uring_setup(CFG)
+{
+  struct diskus_io		*io=cfg->io;
+  struct io_uring_params	p;
+
+  memset(&p, 0, sizeof p);
+  if ((io->ring=syscall(__NR_io_uring_setup, (unsigned)io->qd, &p))<0)
+    return -1;
+
+  io->sqlen	= p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  io->cqlen	= p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP && io->cqlen>io->sqlen)
+    io->sqlen	= io->cqlen;
+  io->sqmap	= mmap(NULL, io->sqlen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, io->ring, IORING_OFF_SQ_RING);
+  io->cqmap	= io->sqmap;
+  if (io->sqmap!=MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP))
+    io->cqmap	= mmap(NULL, io->cqlen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, io->ring, IORING_OFF_CQ_RING);
+  io->sqelen	= p.sq_entries*sizeof(struct io_uring_sqe);
+  io->sqe	= mmap(NULL, io->sqelen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, io->ring, IORING_OFF_SQES);
+  if (io->sqmap==MAP_FAILED || io->cqmap==MAP_FAILED || io->sqe==MAP_FAILED)
+    {
+      uring_unmap(io);
+      return -1;
+    }
+
+  io->sq_head	= (unsigned *)((char *)io->sqmap+p.sq_off.head);
+  io->sq_tail	= (unsigned *)((char *)io->sqmap+p.sq_off.tail);
+  io->sq_mask	= (unsigned *)((char *)io->sqmap+p.sq_off.ring_mask);
+  io->sq_array	= (unsigned *)((char *)io->sqmap+p.sq_off.array);
+  io->cq_head	= (unsigned *)((char *)io->cqmap+p.cq_off.head);
+  io->cq_tail	= (unsigned *)((char *)io->cqmap+p.cq_off.tail);
+  io->cq_mask	= (unsigned *)((char *)io->cqmap+p.cq_off.ring_mask);
+  io->cqe	= (struct io_uring_cqe *)((char *)io->cqmap+p.cq_off.cqes);
+  io->pending	= 0;
+  return 0;
+}
+
+static int
+uring_submit(CFG, struct diskus_slot *slot)
+{
+  struct diskus_io	*io=cfg->io;
+  struct io_uring_sqe	*sqe;
+  unsigned		tail, idx;
+
+  tail		= *io->sq_tail;
+  idx		= tail & *io->sq_mask;
+  sqe		= &io->sqe[idx];
+  memset(sqe, 0, sizeof *sqe);
+
+  slot->iov.iov_base	= slot->ptr;
+  slot->iov.iov_len	= slot->len;
+  sqe->opcode	= io->write ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd	= cfg->fd;
+  sqe->off	= slot->pos;
+  sqe->addr	= (unsigned long)&slot->iov;
+  sqe->len	= 1;
+  sqe->user_data	= slot-io->slot;
+
+  io->sq_array[idx]	= idx;
+  __atomic_store_n(io->sq_tail, tail+1, __ATOMIC_RELEASE);
+  io->pending++;
+  return 0;
+}
+
+static int
+uring_reap(CFG, int wait)
+{
+  struct diskus_io	*io=cfg->io;
+  unsigned		head;
+  int			got;
+
+  /* Submits the queued requests with the same syscall.
+   * EINTR is expected here, as the progress meter uses SIGALRM.
+   */
+  while (syscall(__NR_io_uring_enter, io->ring, (unsigned)io->pending, wait ? 1u : 0u, wait ? IORING_ENTER_GETEVENTS : 0u, NULL, 0)<0)
+    if (errno!=EINTR && errno!=EAGAIN && errno!=EBUSY)
+      return -1;
+  io->pending	= 0;
+
+  got	= 0;
+  for (head= *io->cq_head; head!=__atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE); head++, got++)
+    {
+      struct io_uring_cqe	*cqe=&io->cqe[head & *io->cq_mask];
+      struct diskus_slot	*slot=&io->slot[cqe->user_data];
+
+      io_done(cfg, slot, cqe->res);
+    }
+  __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+  return got;
+}
+
+static void
+uring_exit(CFG)
+{
+  uring_unmap(cfg->io);
+}
+
+static const struct diskus_engine	engine_uring =
+  { "uring", uring_setup, uring_submit, uring_reap, uring_exit };
+#endif
+
+#ifdef DISKUS_AIO
+/* Linux native AIO (io_submit/io_getevents) for kernels where
+ * io_uring is missing or locked down.  Without O_DIRECT (-async)
+ * io_submit() just blocks, which still works.
+ */
+static int
+aio_setup(CFG)
+{
+  struct diskus_io	*io=cfg->io;
+
+  io->ctx	= 0;
+  if (syscall(__NR_io_setup, io->qd, &io->ctx)<0)
+    return -1;
+  io->iocbs	= tino_alloc0O(io->qd * sizeof *io->iocbs);
+  io->events	= tino_alloc0O(io->qd * sizeof *io->events);
+  io->npend	= 0;
+  return 0;
+}
+
+static int
+aio_submit(CFG, struct diskus_slot *slot)
+{
+  struct diskus_io	*io=cfg->io;
+  struct iocb		*cb=&slot->iocb;
+
+  memset(cb, 0, sizeof *cb);
+  cb->aio_lio_opcode	= io->write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+  cb->aio_fildes	= cfg->fd;
+  cb->aio_buf		= (unsigned long)slot->ptr;
+  cb->aio_nbytes	= slot->len;
+  cb->aio_offset	= slot->pos;
+  cb->aio_data		= slot-io->slot;
+  io->iocbs[io->npend++]	= cb;
+  return 0;
+}
+
+static int
+aio_reap(CFG, int wait)
+{
+  struct diskus_io	*io=cfg->io;
+  long			got;
+  int			i;
+
+  while (io->npend)
+    {
+      if ((got=syscall(__NR_io_submit, io->ctx, (long)io->npend, io->iocbs))<0)
+	{
+	  if (errno==EINTR || errno==EAGAIN)
+	    continue;
+	  return -1;
+	}
+      io->npend	-= got;
+      memmove(io->iocbs, io->iocbs+got, io->npend * sizeof *io->iocbs);
+    }
+
+  while ((got=syscall(__NR_io_getevents, io->ctx, wait ? 1l : 0l, (long)io->qd, io->events, NULL))<0)
+    if (errno!=EINTR)
+      return -1;
+
+  for (i=0; i<got; i++)
+    {
+      struct diskus_slot	*slot=&io->slot[io->events[i].data];
+
+      io_done(cfg, slot, io->events[i].res);
+    }
+  return got;
+}
+
+static void
+aio_exit(CFG)
+{
+  syscall(__NR_io_destroy, cfg->io->ctx);
+}
+
+static const struct diskus_engine	engine_aio =
+  { "aio", aio_setup, aio_submit, aio_reap, aio_exit };
+#endif
+
+#ifdef DISKUS_VERIFY
+/* The "verify" engine does not transfer any data.  The drive checks
+ * the blocks itself, with NVMe Verify or SCSI VERIFY(16).  Blocks
+ * handed out are left alone, so only read_worker() can use this.
+ *
+ * Only medium errors are read errors.  Anything else the drive says
+ * sets io->abort, as then the command is not working at all.
+ */
+#define	VERIFY_TIMEOUT	60000	/* ms	*/
+#define	VERIFY_BLOCKS	65536	/* NVMe limit per command	*/
+#define	VERIFY_ONCS	0x80	/* Identify Controller ONCS: Verify	*/
+
+/* Verify n LBAs.  Returns 0 on success, -1 on a medium error, else
+ * the status of the command (NVMe status, SCSI sense key, ASC and
+ * ASCQ) or errno if it could not be issued.
+ */
+static int
+verify_lba(CFG, unsigned long long lba, unsigned n)
+{
+  struct diskus_io	*io=cfg->io;
+  int			ret, i;
+
+  if (io->nsid)
+    {
+      struct nvme_passthru_cmd	cmd;
+
+      memset(&cmd, 0, sizeof cmd);
+      cmd.opcode	= 0x0c;		/* Verify	*/
+      cmd.nsid		= io->nsid;
+      cmd.cdw10		= lba;
+      cmd.cdw11		= lba>>32;
+      cmd.cdw12		= n-1;		/* 0's based	*/
+      cmd.timeout_ms	= VERIFY_TIMEOUT;
+      if ((ret=ioctl(cfg->fd, NVME_IOCTL_IO_CMD, &cmd))<0)
+	return errno;
+      if (((ret>>8)&7)==2)
+	return -1;			/* Media and Data Integrity Errors	*/
+      return ret;
+    }
+  else
+    {
+      unsigned char	cdb[16], sense[32];
+      sg_io_hdr_t	hdr;
+      int		key;
+
+      memset(cdb, 0, sizeof cdb);
+      cdb[0]	= 0x8f;			/* VERIFY(16), BYTCHK=0	*/
+      for (i=0; i<8; i++)
+	cdb[2+i]	= lba>>(56-8*i);
+      for (i=0; i<4; i++)
+	cdb[10+i]	= n>>(24-8*i);
+
+      memset(&hdr, 0, sizeof hdr);
+      hdr.interface_id		= 'S';
+      hdr.cmd_len		= sizeof cdb;
+      hdr.cmdp			= cdb;
+      hdr.dxfer_direction	= SG_DXFER_NONE;
+      hdr.sbp			= sense;
+      hdr.mx_sb_len		= sizeof sense;
+      hdr.timeout		= VERIFY_TIMEOUT;
+      if (ioctl(cfg->fd, SG_IO, &hdr))
+	return errno;
+      if ((hdr.info&SG_INFO_OK_MASK)==SG_INFO_OK)
+	return 0;
+      if ((sense[0]&0x7e)==0x72 && hdr.sb_len_wr>=4)	/* descriptor format	*/
+	ret	= (sense[1]&0xf)<<16 | sense[2]<<8 | sense[3];
+      else if ((sense[0]&0x7e)==0x70 && hdr.sb_len_wr>=14)
+	ret	= (sense[2]&0xf)<<16 | sense[12]<<8 | sense[13];
+      else
+	return 0xff0000;		/* no sense data	*/
+      key	= ret>>16;
+      if (key==1)
+	return 0;			/* RECOVERED ERROR	*/
+      if (key==3)
+	return -1;			/* MEDIUM ERROR	*/
+      return ret;
+    }
+}
+
+static int
+verify_setup(CFG)
+{
+  struct diskus_io	*io=cfg->io;
+  struct stat		st;
+  unsigned long long	size;
+  char			path[80];
+  FILE			*fd;
+  int			nsid, ver;
+
+  io->qd	= 1;
+  if (io->write || fstat(cfg->fd, &st) || !S_ISBLK(st.st_mode)
+      || ioctl(cfg->fd, BLKSSZGET, &io->lbs) || ioctl(cfg->fd, BLKGETSIZE64, &size))
+    return -1;
+  io->size	= size;
+
+  /* The commands address the whole disk, not the partition
+   */
+  io->start	= 0;
+  snprintf(path, sizeof path, "/sys/dev/block/%u:%u/start", major(st.st_rdev), minor(st.st_rdev));
+  if ((fd=fopen(path, "r"))!=NULL)
+    {
+      if (fscanf(fd, "%lld", &io->start)!=1)
+	io->start	= -1;
+      fclose(fd);
+      if (io->start<0)
+	return -1;
+      io->start	*= 512;		/* sysfs always counts 512 byte units	*/
+    }
+
+  nsid		= ioctl(cfg->fd, NVME_IOCTL_ID);
+  io->nsid	= nsid>0 ? nsid : 0;
+  if (io->nsid)
+    {
+      struct nvme_admin_cmd	cmd;
+      unsigned char		id[4096];
+
+      /* Verify is optional, see ONCS of Identify Controller	*/
+      memset(&cmd, 0, sizeof cmd);
+      cmd.opcode	= 0x06;		/* Identify	*/
+      cmd.addr		= (unsigned long)id;
+      cmd.data_len	= sizeof id;
+      cmd.cdw10		= 1;		/* Controller	*/
+      cmd.timeout_ms	= VERIFY_TIMEOUT;
+      if (ioctl(cfg->fd, NVME_IOCTL_ADMIN_CMD, &cmd) || !(id[520] & VERIFY_ONCS))
+	return -1;
+    }
+  else if (ioctl(cfg->fd, SG_GET_VERSION_NUM, &ver) || verify_lba(cfg, 0, 0))
+    return -1;		/* length 0 checks the command only	*/
+  return 0;
+}
+
+static int
+verify_submit(CFG, struct diskus_slot *slot)
+{
+  struct diskus_io	*io=cfg->io;
+  long long		pos, end;
+  int			n, ret;
+
+  end	= slot->pos+slot->len;
+  if (end>io->size)
+    end	= io->size;		/* short read at the end	*/
+  for (pos=slot->pos; pos<end; pos+=n)
+    {
+      n	= end-pos;
+      if (n>VERIFY_BLOCKS*io->lbs)
+	n	= VERIFY_BLOCKS*io->lbs;
+      if (pos%io->lbs || n%io->lbs)
+	{
+	  io_done(cfg, slot, -EINVAL);
+	  return 0;
+	}
+      if ((ret=verify_lba(cfg, (io->start+pos)/io->lbs, n/io->lbs))<0)
+	{
+	  io_done(cfg, slot, -EIO);
+	  return 0;
+	}
+      if (ret)
+	{
+	  TINO_ERR3("ETTDU163A %s: verify failed with status 0x%x at pos=%lld, this is no medium error", cfg->name, ret, pos);
+	  io->abort	= ret;
+	  io_done(cfg, slot, -EPROTO);
+	  return 0;
+	}
+    }
+  io_done(cfg, slot, end>slot->pos ? end-slot->pos : 0);
+  return 0;
+}
+
+static const struct diskus_engine	engine_verify =
+  { "verify", verify_setup, verify_submit, sync_reap, sync_exit };
+#endif
+
+/* In order of preference for "-engine auto".
+ * auto always stops at sync, engines behind it must be asked for.
+ */
+static const struct diskus_engine	*diskus_engines[] =
+  {
+#ifdef DISKUS_URING
+    &engine_uring,
+#endif
+#ifdef DISKUS_AIO
+    &engine_aio,
+#endif
+    &engine_sync,
+#ifdef DISKUS_VERIFY
+    &engine_verify,
+#endif
+    NULL
+  };
+
+/* Buffer arena for the I/O blocks
+ *
+ * Blocks are cut from mappings sized for the queue of the io_open()
+ * which needs them, preferably on the NUMA node of the device.  Blocks
+ * of 2 MiB and more are backed by huge pages if there are any reserved
+ * (else transparent huge pages are asked for).  Mappings are locked
+ * into memory as long as this fits into ulimit -l, else they are left
+ * as they are.  io_close() hands the blocks back for the next
+ * io_open(), nothing is unmapped.  There is an arena per NUMA node,
+ * shared by all jobs, the threads of -threads and the -verify-lag
+ * reader.
+ */
+#define	ARENA_PAGE	4096
+#define	ARENA_HUGE	(2*1024*1024)
+#define	ARENA_NODES	64
+
+#ifdef DISKUS_ARENA
+struct diskus_buf
+  {
+    struct diskus_buf	*next;
+    unsigned char	*ptr;
+    size_t		size;
+  };
+
+static struct diskus_arena
+  {
+    unsigned char	*ptr;		/* unused rest of the last mapping	*/
+    size_t		left;
+    struct diskus_buf	*free, *used;
+  }			diskus_arena[ARENA_NODES+1];	/* [0] is unknown node	*/
+static pthread_mutex_t	diskus_arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t		diskus_arena_locked;
+
+/* len is a multiple of ARENA_HUGE for huge blocks, else of ARENA_PAGE
+ */
+static int
+arena_map(CFG, struct diskus_arena *a, size_t len, int huge)
+{
+  unsigned char	*ptr;
+  size_t	off;
+  struct rlimit	lim;
+
+  ptr	= MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (huge)
+    ptr	= mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+  if (ptr==MAP_FAILED && !huge)
+    {
+      if ((ptr=mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0))==MAP_FAILED)
+	return -1;
+    }
+  else if (ptr==MAP_FAILED)
+    {
+      /* Align it, such that THP can use huge pages	*/
+      if ((ptr=mmap(NULL, len+ARENA_HUGE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0))==MAP_FAILED)
+	return -1;
+      off	= -(unsigned long)ptr & (ARENA_HUGE-1);
+      if (off)
+	munmap(ptr, off);
+      munmap(ptr+off+len, ARENA_HUGE-off);
+      ptr	+= off;
+#ifdef MADV_HUGEPAGE
+      madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+    }
+#ifdef __NR_mbind
+  if (cfg->numa>=0 && cfg->numa<ARENA_NODES)
+    {
+      unsigned long	mask=1ul<<cfg->numa;
+
+      syscall(__NR_mbind, ptr, len, MPOL_PREFERRED, &mask, 8*sizeof mask+1, 0);
+    }
+#endif
+  /* This faults the pages in, on the node set above.  Locking is
+   * only tried within ulimit -l, it is not worth a warning.
+   */
+  if (!getrlimit(RLIMIT_MEMLOCK, &lim) &&
+      (lim.rlim_cur==RLIM_INFINITY || diskus_arena_locked+len<=lim.rlim_cur) &&
+      !mlock(ptr, len))
+    diskus_arena_locked	+= len;
+  a->ptr	= ptr;
+  a->left	= len;
+  return 0;
+}
+#endif
+
+/* Returns a zeroed block of at least size bytes, NULL if out of memory
+ *
+ * The caller needs count such blocks, including this one, a new
+ * mapping is made large enough for all of them.
+ */
+static unsigned char *
+arena_get(CFG, size_t size, int count)
+{
+#ifdef DISKUS_ARENA
+  struct diskus_arena	*a;
+  struct diskus_buf	**p, **best, *b;
+  size_t		skip;
+  int			old;
+
+  size	= (size+ARENA_PAGE-1) & ~(size_t)(ARENA_PAGE-1);
+  if (size>=ARENA_HUGE)
+    size	= (size+ARENA_HUGE-1) & ~(size_t)(ARENA_HUGE-1);
+  a	= &diskus_arena[cfg->numa>=0 && cfg->numa<ARENA_NODES ? cfg->numa+1 : 0];
+
+  pthread_mutex_lock(&diskus_arena_mutex);
+  best	= 0;
+  for (p=&a->free; *p; p=&(*p)->next)
+    if ((*p)->size>=size && (!best || (*p)->size<(*best)->size))
+      best	= p;
+  old	= best!=0;
+  if (best)
+    {
+      b		= *best;
+      *best	= b->next;
+    }
+  else
+    {
+      /* Large blocks start on a huge page	*/
+      skip	= size>=ARENA_HUGE ? -(unsigned long)a->ptr & (ARENA_HUGE-1) : 0;
+      if (a->left<size+skip)
+	{
+	  if (arena_map(cfg, a, size*(count>1 ? count : 1), size>=ARENA_HUGE))
+	    {
+	      pthread_mutex_unlock(&diskus_arena_mutex);
+	      return 0;
+	    }
+	  skip	= 0;
+	}
+      b		= tino_allocO(sizeof *b);
+      b->ptr	= a->ptr+skip;
+      b->size	= size;
+      a->ptr	+= size+skip;
+      a->left	-= size+skip;
+    }
+  b->next	= a->used;
+  a->used	= b;
+  pthread_mutex_unlock(&diskus_arena_mutex);
+
+  if (old)
+    memset(b->ptr, 0, size);	/* fresh mappings are zero	*/
+  return b->ptr;
+#else
+  unsigned char	*ptr;
+
+  ptr	= tino_alloc_alignedO(size);
+  memset(ptr, 0, size);
+  return ptr;
+#endif
+}
+
+static void
+arena_put(CFG, unsigned char *ptr)
+{
+#ifdef DISKUS_ARENA
+  struct diskus_arena	*a;
+  struct diskus_buf	**p, *b;
+
+  a	= &diskus_arena[cfg->numa>=0 && cfg->numa<ARENA_NODES ? cfg->numa+1 : 0];
+  pthread_mutex_lock(&diskus_arena_mutex);
+  for (p=&a->used; (b=*p)!=NULL; p=&b->next)
+    if (b->ptr==ptr)
+      {
+	*p	= b->next;
+	b->next	= a->free;
+	a->free	= b;
+	break;
+      }
+  pthread_mutex_unlock(&diskus_arena_mutex);
+#else
+  tino_freeO(ptr);
+#endif
+}
+
+/* Undo a failed io_open(), the engine must not be set up
+ */
+static void
+io_free(CFG)
+{
+  struct diskus_io	*io=cfg->io;
+  int			i;
+
+  if (io->slot)
+    {
+      for (i=0; i<io->qd; i++)
+	if (io->slot[i].buf)
+	  arena_put(cfg, io->slot[i].buf);
+      tino_freeO(io->slot);
+    }
+  tino_freeO(io);
+  cfg->io	= 0;
+}
+
+/* On failure nothing is left, cfg->io is NULL
+ */
+static int
+io_open(CFG, int write, int qd)
+{
+  struct diskus_io			*io;
+  const struct diskus_engine	*const *e;
+  const char				*name;
+  int					i;
+
+  io		= tino_alloc0O(sizeof *io);
+  cfg->io	= io;
+  io->write	= write;
+
+  name	= cfg->engine;
+  if (name && !strcmp(name, "auto"))
+    name	= 0;
+  for (e=diskus_engines; *e; e++)
+    {
+      if (name ? strcmp(name, (*e)->name) : qd<2 && *e!=&engine_sync)
+	continue;	/* plain sync I/O is the default for -qd 1	*/
+      io->e	= *e;
+      io->qd	= qd;
+      if (!io->e->setup(cfg))
+	break;
+      if (name)
+	{
+	  TINO_ERR2("ETTDU126A %s: engine %s not available", cfg->name, name);
+	  io_free(cfg);
+	  return -1;
+	}
+    }
+  if (!*e)
+    {
+      TINO_ERR2("ETTDU127F %s: unknown engine %s", cfg->name, name);
+      io_free(cfg);
+      return -1;
+    }
+  if (!name && qd>1 && cfg->qd>1 && io->qd<2 && !cfg->quiet && !(cfg->probed&PROBED_QD))
+    TINO_ERR1("WTTDU128 %s: no queueing engine available, using sync I/O", cfg->name);
+
+  io->slot	= tino_alloc0O(io->qd * sizeof *io->slot);
+  for (i=0; i<io->qd; i++)
+    if ((io->slot[i].buf=arena_get(cfg, cfg->bs, io->qd-i))==NULL)
+      {
+	TINO_ERR2("ETTDU159A %s: out of memory for %d I/O blocks", cfg->name, io->qd);
+	io->e->exit(cfg);
+	io_free(cfg);
+	return -1;
+      }
+  return 0;
+}
+
+/* Wait for all requests in flight
+ */
+static int
+io_drain(CFG)
+{
+  struct diskus_io	*io=cfg->io;
+  int			i;
+
+  for (i=0; i<io->qd; i++)
+    while (io->slot[i].state==SLOT_BUSY)
+      if (io->e->reap(cfg, 1)<0)
+	{
+	  TINO_ERR1("FTTDU129A %s: internal fatal error, cannot reap I/O requests", cfg->name);
+	  return -1;
+	}
+  return 0;
+}
+
+/* Forget everything queued and continue at pos
+ */
+static int
+io_seek(CFG, long long pos)
+{
+  struct diskus_io	*io=cfg->io;
+  int			i;
+
+  if (io_drain(cfg))
+    return -1;
+  for (i=0; i<io->qd; i++)
+    io->slot[i].state	= SLOT_FREE;
+  io->head	= 0;
+  io->cnt	= 0;
+  io->next	= pos;
+  io->step	= 0;
+  return 0;
+}
+
+static int
+io_close(CFG)
+{
+  int	ret;
+
+  ret	= io_drain(cfg);
+  cfg->io->e->exit(cfg);
+  if (!ret)
+    {
+      int	i;
+
+      for (i=0; i<cfg->io->qd; i++)
+	arena_put(cfg, cfg->io->slot[i].buf);
+      tino_freeO(cfg->io->slot);
+      cfg->io->slot	= 0;
+    }
+  return ret;
+}
+
+static int
+io_submit(CFG, struct diskus_slot *slot, long long pos, int len)
+{
+  struct diskus_io	*io=cfg->io;
+
+  slot->pos	= pos;
+  slot->len	= len;
+  slot->res	= 0;
+  slot->state	= SLOT_BUSY;
+  slot->t0	= diskus_usec();
+  io->cnt++;
+  io->next	= pos+len;
+  return io->e->submit(cfg, slot);
+}
+
+/* True if there is something left to read
+ */
+static int
+io_more(CFG)
+{
+  return cfg->walk ? cfg->io->step<cfg->walkdom : !cfg->endpos || cfg->io->next<cfg->endpos;
+}
+
+/* Keep the read queue filled up to cfg->endpos
+ */
+static int
+io_fill(CFG)
+{
+  struct diskus_io	*io=cfg->io;
+
+  while (io->cnt<io->qd && io_more(cfg))
+    {
+      struct diskus_slot	*tmp=&io->slot[(io->head+io->cnt) % io->qd];
+      long long			pos;
+      int			len;
+
+      pos	= io->next;
+      len	= cfg->cur;
+      if (cfg->walk)
+	{
+	  if ((pos=walk_pos(cfg, io->step++))<0)
+	    continue;
+	  if (pos+len>cfg->walkto)
+	    len	= cfg->walkto-pos;
+	}
+      else if (cfg->endpos && pos+len>cfg->endpos)
+	len	= cfg->endpos-pos;
+      tmp->ptr	= tmp->buf;
+      tmp->step	= io->step;
+      if (io_submit(cfg, tmp, pos, len))
+	return -1;
+    }
+  return 0;
+}
+
+/* Returns the next block in ascending order, like tino_file_readE().
+ *
+ * The block stays valid until the next call to io_read() or io_seek().
+ */
+static int
+io_read(CFG, unsigned char **block)
+{
+  struct diskus_io	*io=cfg->io;
+  struct diskus_slot	*slot;
+  int			i;
+
+  slot	= &io->slot[io->head];
+  if (io->cnt && slot->state==SLOT_USED)
+    {
+      slot->state	= SLOT_FREE;
+      io->head		= (io->head+1) % io->qd;
+      io->cnt--;
+    }
+
+  if (io_fill(cfg))
+    return -1;
+  if (!io->cnt)
+    return 0;
+
+  slot	= &io->slot[io->head];
+  while (slot->state==SLOT_BUSY)
+    if (io->e->reap(cfg, 1)<0)
+      return -1;
+  slot->state	= SLOT_USED;
+  *block	= slot->ptr;
+
+  if (slot->res<slot->len)
+    {
+      /* Short read, EOF or error: Everything queued behind is
+       * void, the caller continues at the end of this block.
+       */
+      io->next	= slot->pos+(slot->res>0 ? slot->res : 0);
+      io->step	= slot->step;
+      for (i=1; i<io->cnt; i++)
+	{
+	  struct diskus_slot	*tmp=&io->slot[(io->head+i) % io->qd];
+
+	  while (tmp->state==SLOT_BUSY)
+	    if (io->e->reap(cfg, 1)<0)
+	      return -1;
+	  tmp->state	= SLOT_FREE;
+	}
+      io->cnt	= 1;
+      if (slot->res<0)
+	{
+	  errno	= -slot->res;
+	  return -1;
+	}
+    }
+  return slot->res;
+}
+
+/* True if io_read() returns the next block without waiting.
+ * With -qd 1 the only slot is in use, so it has to submit first.
+ */
+static int
+io_ready(CFG)
+{
+  struct diskus_io	*io=cfg->io;
+  int			i;
+
+  i	= io->cnt && io->slot[io->head].state==SLOT_USED;
+  if (i>=io->cnt)
+    return i && io_more(cfg);
+  if (io->slot[(io->head+i) % io->qd].state==SLOT_BUSY)
+    io->e->reap(cfg, 0);
+  return io->slot[(io->head+i) % io->qd].state!=SLOT_BUSY;
+}
+
+/* Retire write requests from the head of the queue.
+ * Only the first failing write (in position order) is remembered.
+ */
+static void
+io_retire(CFG, int wait)
+{
+  struct diskus_io	*io=cfg->io;
+
+  while (io->cnt)
+    {
+      struct diskus_slot	*slot=&io->slot[io->head];
+
+      if (slot->state==SLOT_BUSY)
+	{
+	  if (!wait)
+	    break;
+	  if (io->e->reap(cfg, 1)<0)
+	    {
+	      slot->res	= -errno;
+	      slot->state	= SLOT_DONE;
+	    }
+	  continue;
+	}
+      if (slot->res==slot->len)
+	keep_mark(cfg, slot->pos, slot->pos+slot->len, cfg->keepok);
+      else
+	{
+	  keep_mark(cfg, slot->pos, slot->pos+(slot->res>0 ? slot->res : 0), cfg->keepok);
+	  keep_mark(cfg, slot->pos+(slot->res>0 ? slot->res : 0), slot->pos+slot->len, 'W');
+	}
+      if (slot->res!=slot->len && !io->failed)
+	{
+	  io->failed	= 1;
+	  io->failpos	= slot->pos;
+	  io->failput	= slot->res>0 ? slot->res : 0;
+	  io->failerr	= slot->res<0 ? -slot->res : ENOSPC;
+	}
+      slot->state	= SLOT_FREE;
+      io->head		= (io->head+1) % io->qd;
+      io->cnt--;
+    }
+}
+
+/* Get the next free block to fill for io_write()
+ */
+static unsigned char *
+io_buf(CFG)
+{
+  struct diskus_io	*io=cfg->io;
+
+  while (io->cnt>=io->qd)
+    {
+      struct diskus_slot	*slot=&io->slot[io->head];
+
+      if (slot->state==SLOT_BUSY && io->e->reap(cfg, 1)<0)
+	{
+	  slot->res	= -errno;
+	  slot->state	= SLOT_DONE;
+	}
+      io_retire(cfg, 0);
+    }
+  return io->slot[(io->head+io->cnt) % io->qd].buf;
+}
+
+/* Queue the block returned by io_buf() to be written at io->next.
+ * Returns nonzero if some write failed so far.
+ */
+static int
+io_write(CFG, unsigned char *block, int len)
+{
+  struct diskus_io	*io=cfg->io;
+  struct diskus_slot	*slot;
+
+  slot	= &io->slot[(io->head+io->cnt) % io->qd];
+  slot->ptr	= block;
+  if (io_submit(cfg, slot, io->next, len))
+    {
+      slot->res		= -errno;
+      slot->state	= SLOT_DONE;
+    }
+  io->e->reap(cfg, 0);
+  io_retire(cfg, 0);
+  return io->failed;
+}
+
+/* Wait for all writes to finish.  Returns nonzero on failure.
+ */
+static int
+io_sync(CFG)
+{
+  io_retire(cfg, 1);
+  return cfg->io->failed;
+}
+
+/* The read loop for -walk.  Blocks come in walk order, the worker
+ * is told the position of each block.  Read errors void the block,
+ * with -jump the walk continues with the next one.
+ */
+static int
+walk_read(CFG, diskus_worker_fn worker)
+{
+  struct diskus_io	*io=cfg->io;
+  struct diskus_slot	*slot;
+  unsigned char		*block;
+  int			got, tmp;
+
+  if (walk_setup(cfg))
+    {
+      TINO_ERR1("ETTDU150A %s: -walk needs -to or a device with known size", cfg->name);
+      return diskus_ret_param;
+    }
+  if (cfg->walk==WALK_RANDOM && !cfg->quiet)
+    diskus_log(cfg, "walk random:%llu", cfg->seed);
+  if (io_seek(cfg, cfg->walkfrom))
+    return diskus_ret_read;
+  for (;;)
+    {
+      TINO_ALARM_RUN();
+      got	= io_read(cfg, &block);
+      TINO_ALARM_RUN();
+      if (!got && !io->cnt)
+	break;			/* walk done	*/
+      if (got<0 && io->abort)
+	return diskus_ret_read;
+
+      slot	= &io->slot[io->head];
+      cfg->pos	= slot->pos;
+      cfg->nr	= cfg->pos/cfg->ssz;
+      if (got<slot->len)
+	{
+	  keep_mark(cfg, slot->pos, slot->pos+slot->len, 'R');
+	  if (!cfg->jump)
+	    {
+	      TINO_ERR3("ETTDU101A %s: read error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
+	      return diskus_ret_read;
+	    }
+	  cfg->nxt	= slot->pos+slot->len;
+	  diskus_err(cfg, ERR_READ, diskus_ret_read, "read error, skip block of %d sectors", slot->len/cfg->ssz);
+	  continue;
+	}
+
+      keep_mark(cfg, cfg->pos, cfg->pos+got, cfg->keepok);
+      if ((tmp=worker(cfg, block, got))!=0)
+	return tmp;
+      if (cfg->pos!=slot->pos+got || cfg->nr!=cfg->pos/cfg->ssz)
+	{
+	  TINO_ERR1("FTTDU118A %s: internal fatal error, worker failed to update counters", cfg->name);
+	  return diskus_ret_param;
+	}
+      if (cfg->rcount && (cfg->nr>cfg->rto || cfg->nr<cfg->rfrom))
+	range_close(cfg);	/* walk has left the error range	*/
+    }
+  cfg->pos	= cfg->walkto;
+  cfg->nr	= cfg->pos/cfg->ssz;
+  return 0;
+}
+
+/* Option -retry
+ *
+ * Read errors do not stop the scan.  The failed block (and what -jump
+ * skips in addition) goes to a queue of ranges, and the scan streams
+ * on.  After the scan, up to -retry passes go over the queue, each
+ * with smaller blocks and in the other direction, so a bad spot is
+ * also approached from behind.  The last pass reads single sectors
+ * (or -vary).  What is left in the end is reported as read errors.
+ */
+static void
+retry_add(CFG, long long from, long long to)
+{
+  long long	*r;
+
+  if (from>=to)
+    return;
+  r	= cfg->retryq+2*cfg->nretry;
+  if (cfg->nretry && r[-1]==from)
+    {
+      r[-1]	= to;
+      return;
+    }
+  if (cfg->nretry && r[-2]==to)
+    {
+      r[-2]	= from;	/* reverse pass	*/
+      return;
+    }
+  if (cfg->nretry>=cfg->maxretry)
+    {
+      cfg->maxretry	= cfg->maxretry ? 2*cfg->maxretry : 64;
+      cfg->retryq	= tino_reallocO(cfg->retryq, 2*cfg->maxretry * sizeof *cfg->retryq);
+    }
+  cfg->retryq[2*cfg->nretry]	= from;
+  cfg->retryq[2*cfg->nretry+1]	= to;
+  cfg->nretry++;
+}
+
+/* First pass: Queue the failed block and continue behind it
+ */
+static void
+retry_skip(CFG)
+{
+  long long	end;
+
+  end	= cfg->pos+cfg->cur;
+  if (cfg->endpos && end>cfg->endpos)
+    end	= cfg->endpos;
+  if (!backoff(cfg) && cfg->nxt>end)
+    end	= cfg->nxt;
+  keep_mark(cfg, cfg->pos, end, 'S');
+  retry_add(cfg, cfg->pos, end);
+  cfg->nxt	= end;
+  cfg->pos	= end;
+}
+
+/* Read one block of a retry pass.  What fails is queued again.
+ */
+static int
+retry_block(CFG, diskus_worker_fn worker, long long pos, int len)
+{
+  unsigned char	*buf=cfg->io->slot[0].buf;
+  long long	t0;
+  int		got, tmp;
+
+  TINO_ALARM_RUN();
+  cfg->pos	= pos;
+  cfg->nr	= pos/cfg->ssz;
+  t0		= diskus_usec();
+  got		= -1;
+  if (tino_file_lseekE(cfg->fd, pos, SEEK_SET)==pos)
+    got	= tino_file_readE(cfg->fd, buf, len);
+  stats_add(cfg, got>0 ? got : 0, diskus_usec()-t0);
+  zone_add(cfg, pos, diskus_usec()-t0);
+  if (!got)
+    {
+      keep_mark(cfg, pos, pos+len, 'P');
+      return 0;
+    }
+  if (got<0)
+    got	= 0;
+  got	-= SSZ_OFFSET(got);
+  if (got)
+    {
+      keep_mark(cfg, pos, pos+got, cfg->keepok);
+      if ((tmp=worker(cfg, buf, got))!=0)
+	return tmp;
+    }
+  retry_add(cfg, pos+got, pos+len);
+  return 0;
+}
+
+static int
+retry_run(CFG, diskus_worker_fn worker)
+{
+  long long	pos, nr, *r, sects;
+  int		pass, n, i, size, min, ret;
+  time_t	end;
+
+  if (!cfg->nretry)
+    return 0;
+  if (io_seek(cfg, cfg->pos))
+    return diskus_ret_read;
+  pos	= cfg->pos;
+  nr	= cfg->nr;
+  min	= cfg->vary ? cfg->vary : cfg->ssz;
+  end	= cfg->retrytime ? time(NULL)+cfg->retrytime : 0;
+  for (pass=1, size=cfg->bs; pass<=cfg->retry && cfg->nretry; pass++)
+    {
+      size	/= 4;
+      size	-= SSZ_OFFSET(size);
+      if (size<min || pass==cfg->retry)
+	size	= min;
+
+      r			= cfg->retryq;
+      n			= cfg->nretry;
+      cfg->retryq	= 0;
+      cfg->nretry	= 0;
+      cfg->maxretry	= 0;
+      for (sects=0, i=0; i<n; i++)
+	sects	+= (r[2*i+1]-r[2*i])/cfg->ssz;
+      if (!cfg->quiet)
+	diskus_log(cfg, "retry pass %d: %d ranges of %lld sectors in total, blocks of %d%s", pass, n, sects, size, (pass&1 ? ", reverse" : ""));
+
+      for (i=0; i<n; i++)
+	{
+	  long long	from, to;
+	  int		len;
+
+	  from	= r[2*(pass&1 ? n-1-i : i)];
+	  to	= r[2*(pass&1 ? n-1-i : i)+1];
+	  while (from<to)
+	    {
+	      if (end && time(NULL)>=end)
+		{
+		  retry_add(cfg, from, to);	/* out of budget	*/
+		  break;
+		}
+	      len	= to-from>size ? size : to-from;
+	      if (pass&1)
+		{
+		  if ((ret=retry_block(cfg, worker, to-len, len))!=0)
+		    return ret;
+		  to	-= len;
+		}
+	      else
+		{
+		  if ((ret=retry_block(cfg, worker, from, len))!=0)
+		    return ret;
+		  from	+= len;
+		}
+	    }
+	}
+      tino_freeO(r);
+
+      /* Keep the queue in ascending order	*/
+      if (pass&1)
+	for (i=0, n=cfg->nretry; i<--n; i++)
+	  {
+	    long long	a=cfg->retryq[2*i], b=cfg->retryq[2*i+1];
+
+	    cfg->retryq[2*i]	= cfg->retryq[2*n];
+	    cfg->retryq[2*i+1]	= cfg->retryq[2*n+1];
+	    cfg->retryq[2*n]	= a;
+	    cfg->retryq[2*n+1]	= b;
+	  }
+      if (end && time(NULL)>=end)
+	break;
+    }
+
+  /* Whatever is left is bad	*/
+  for (i=0; i<cfg->nretry; i++)
+    {
+      cfg->pos	= cfg->retryq[2*i];
+      cfg->nr	= cfg->pos/cfg->ssz;
+      cfg->nxt	= cfg->retryq[2*i+1];
+      keep_mark(cfg, cfg->pos, cfg->nxt, 'R');
+      diskus_err(cfg, ERR_READ, diskus_ret_read, "read error, %llu sectors after %d retry passes", (cfg->nxt-cfg->pos)/cfg->ssz, pass-1);
+    }
+  tino_freeO(cfg->retryq);
+  cfg->retryq	= 0;
+  cfg->nretry	= 0;
+  cfg->maxretry	= 0;
+  cfg->pos	= pos;
+  cfg->nr	= nr;
+  return 0;
+}
+
+static int
+run_read_type(CFG, int mode, int flags, diskus_worker_fn worker)
+{
+  int		got;
+  unsigned char	*block;
+
+  if ((cfg->fd=tino_file_openE(cfg->name, mode|(cfg->async ? 0 : flags)))<0)
+    {
+      TINO_ERR1("ETTDU100A %s: cannot open", cfg->name);
+      return diskus_ret_param;
+    }
+  /* freshen and patch rewrite in place and reseek, so there is
+   * nothing to gain from reading ahead.
+   */
+  if (io_open(cfg, 0, mode==O_RDONLY ? cfg->qd : 1))
+    {
+      tino_file_closeE(cfg->fd);
+      return diskus_ret_param;
+    }
+  cfg->cur	= cfg->bs;
+  cfg->badend	= 0;
+  block	= cfg->io->slot[0].buf;
+  if (tino_file_read_allE(cfg->fd, block, cfg->bs)<0)
+    {
+      tino_file_closeE(cfg->fd);
+      if ((cfg->fd=tino_file_openE(cfg->name, mode|(cfg->async ? flags : 0)))<0)
+	{
+	  TINO_ERR1("ETTDU100A %s: cannot open", cfg->name);
+	  return diskus_ret_param;
+	}
+      if (!cfg->quiet)
+	TINO_ERR1("WTTDU108 %s: opened with reverse option -async", cfg->name);
+    }
+  if (worker(cfg, NULL, 1))
+    {
+      TINO_ERR1("FTTDU113A %s: internal fatal error, worker could not be initialized", cfg->name);
+      return diskus_ret_param;
+    }
+
+  if (cfg->walk && (got=walk_read(cfg, worker))!=0)
+    return got;
+  while (!cfg->walk && (!cfg->endpos || cfg->pos<cfg->endpos))
+    {
+      xDP(("() pos=%llu", cfg->pos));
+
+      if (SSZ_OFFSET(cfg->pos))
+	{
+	  TINO_ERR2("FTTDU112A %s: internal fatal error, pos %lld not multiple of sector size", cfg->name, cfg->pos);
+	  return diskus_ret_param;
+	}
+
+      /* Repositioning is *required* here, as the position is unknown
+       * here
+       */
+      cfg->nr	= cfg->pos/(unsigned long long)cfg->ssz;
+      if (tino_file_lseekE(cfg->fd, cfg->pos, SEEK_SET)!=cfg->pos)
+	{
+	  TINO_ERR2("ETTDU106E %s: cannot seek to %lld", cfg->name, cfg->pos);
+	  return diskus_ret_seek;
+	}
+      if (io_seek(cfg, cfg->pos))
+	return diskus_ret_read;
+
+      for (;;)
+	{
+	  long long	want;
+	  int		max;
+
+	  max	= cfg->cur;
+	  if (cfg->endpos && cfg->pos+max>cfg->endpos)
+	    max	= cfg->endpos>cfg->pos ? cfg->endpos-cfg->pos : 0;
 
-	  memset(block, 0, max);
 	  TINO_ALARM_RUN();
-	  got	= tino_file_readE(cfg->fd, block, max);
+	  got	= io_read(cfg, &block);
 	  TINO_ALARM_RUN();
 	  if (got<=0)
 	    {
 	      int tmp;
 
-              if ((tmp=worker(cfg, block, -max))!=0)
-		return tmp;
-	      break;
-            }
+	      if (!got && cfg->endpos)
+		keep_mark(cfg, cfg->pos, cfg->endpos, 'P');
+	      if (got<0 && cfg->io->abort)
+		return diskus_ret_read;
+	      if (got<0 && cfg->cur>cfg->vary && cfg->vary && !cfg->retry)
+		break;		/* bisect first, see below	*/
+
+              if ((tmp=worker(cfg, block, -max))!=0)
+		return tmp;
+	      break;
+            }
+
+	  if (SSZ_OFFSET(got))
+	    {
+	      TINO_ERR5("ETTDU108A %s: partial sector read: %d pos=%lld (%lld+%d)", cfg->name, SSZ_OFFSET(got), cfg->pos+got, cfg->pos, got);
+	      return diskus_ret_short;
+	    }
+
+	  want	= cfg->pos+got;
+	  keep_mark(cfg, cfg->pos, want, cfg->keepok);	/* the worker may mark errors	*/
+
+	  if ((got=worker(cfg, block, got))!=0)
+	    break;
+
+	  if (cfg->pos!=want || cfg->nr!=want/cfg->ssz)
+	    {
+	      TINO_ERR1("FTTDU118A %s: internal fatal error, worker failed to update counters", cfg->name);
+	      return diskus_ret_param;
+	    }
+	  if (cfg->rcount && cfg->nr>cfg->rto)
+	    range_close(cfg);	/* scan has left the error range	*/
+
+	  /* -vary: ramp up again once we are past the failing block.
+	   * Blocks already queued keep their size.
+	   */
+	  if (cfg->cur<cfg->bs && cfg->pos>=cfg->badend)
+	    cfg->cur	= cfg->cur>cfg->bs/2 ? cfg->bs : cfg->cur*2;
+	}
+
+      if (got>0)
+	continue;
+      if (!got)
+	break;
+
+      /* -vary: bisect the failing block down to the smallest size
+       * before reporting anything.  The good half is read in one go,
+       * the bad half is split further.
+       */
+      if (cfg->cur>cfg->vary && cfg->vary && !cfg->retry)
+	{
+	  if (cfg->badend<cfg->pos+cfg->cur)
+	    cfg->badend	= cfg->pos+cfg->cur;
+	  cfg->cur	/= 2;
+	  cfg->cur	-= SSZ_OFFSET(cfg->cur);
+	  if (cfg->cur<cfg->vary)
+	    cfg->cur	= cfg->vary;
+	  continue;
+	}
+
+      if (cfg->retry)
+	{
+	  retry_skip(cfg);	/* the retry passes bisect	*/
+	  continue;
+	}
+      keep_mark(cfg, cfg->pos, cfg->pos+cfg->ssz, 'R');
+      if (backoff(cfg))
+	{
+	  TINO_ERR3("ETTDU101A %s: read error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
+	  return diskus_ret_read;
+	}
+      keep_mark(cfg, cfg->pos+cfg->ssz, cfg->nxt, 'S');
+
+      diskus_err(cfg, ERR_READ, diskus_ret_read, "read error, skip %llu to sector %llu", (cfg->nxt-cfg->pos)/cfg->ssz, cfg->nxt/cfg->ssz);
+      cfg->pos	= cfg->nxt;
+      cfg->badend	= 0;	/* bad spot found, -vary may ramp up	*/
+    }
+  if (cfg->retry && (got=retry_run(cfg, worker))!=0)
+    return got;
+
+  if (io_close(cfg) || tino_file_closeE(cfg->fd))
+    {
+      TINO_ERR3("ETTDU101A %s: read error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
+      return diskus_ret_read;
+    }
+  if (worker(cfg, NULL, 0))
+    {
+      TINO_ERR1("FTTDU114A %s: internal fatal error, worker could not be flushed", cfg->name);
+      return diskus_ret_param;
+    }
+  return 0;
+}
+
+static int
+run_read(CFG, diskus_worker_fn worker)
+{
+  return run_read_type(cfg, O_RDONLY, O_DIRECT, worker);
+}
+
+static int
+run_readwrite(CFG, diskus_worker_fn worker)
+{
+  return run_read_type(cfg, O_RDWR, O_DIRECT|O_SYNC, worker);
+}
+
+/* Let the device zero the range itself, for -null -offload.
+ * This does not transfer any data, so nothing is copied at all.
+ * Returns 0 on success, else errno is set.
+ */
+static int
+zero_range(CFG, int blk, long long pos, int len)
+{
+#ifdef DISKUS_ZEROOUT
+  unsigned long long	range[2];
+
+  if (!blk)
+    return fallocate(cfg->fd, FALLOC_FL_ZERO_RANGE, pos, len);
+  range[0]	= pos;
+  range[1]	= len;
+  return ioctl(cfg->fd, BLKZEROOUT, range);
+#else
+  errno	= EOPNOTSUPP;
+  return -1;
+#endif
+}
+
+/* Option -verify-lag
+ *
+ * gen reads back what it has written with a second fd and queue,
+ * -verify-lag bytes behind the last completed write, and checks it
+ * with check_worker().  Lost or misdirected writes are found while
+ * the head is still nearby.  The reader is a copy of the cfg, its
+ * errors are added to the writer's in lag_close().
+ */
+static int
+lag_open(CFG)
+{
+  struct diskus_cfg	*lag;
+  struct diskus_pool	*pool;
+  int			fd;
+
+  if ((fd=tino_file_openE(cfg->name, O_RDONLY|(cfg->async ? 0 : O_DIRECT)))<0)
+    {
+      if ((fd=tino_file_openE(cfg->name, O_RDONLY))<0)
+	{
+	  TINO_ERR1("ETTDU100A %s: cannot open", cfg->name);
+	  return -1;
+	}
+      if (!cfg->quiet)
+	TINO_ERR1("WTTDU155 %s: no O_DIRECT, -verify-lag may only see the cache", cfg->name);
+    }
+  /* The reader is kept for the next range of -keep, as its pool
+   * is bound to it.
+   */
+  if ((lag=cfg->lagcfg)==NULL)
+    lag		= tino_alloc0O(sizeof *lag);
+  pool		= lag->pool;	/* kernels see lag->siglen	*/
+  *lag		= *cfg;
+  cfg->lagcfg	= lag;
+  lag->lagcfg	= 0;
+  lag->pool	= pool;
+  lag->fd	= fd;
+  lag->io	= 0;
+  lag->timefile	= 0;		/* latencies are the writes'	*/
+  lag->zones	= 0;
+  lag->nzones	= 0;
+  lag->keepok	= 'V';
+  lag->fresh	= 1;
+  lag->err	= 0;
+  lag->retflags	= 0;
+  lag->rcount	= 0;
+  lag->cur	= cfg->bs;
+  lag->endpos	= cfg->pos;	/* nothing written yet	*/
+  lag->lag	= (cfg->lag+cfg->bs-1)/cfg->bs*cfg->bs;	/* whole blocks	*/
+  if (tino_file_lseekE(fd, cfg->pos, SEEK_SET)!=cfg->pos)
+    {
+      TINO_ERR2("ETTDU106A %s: cannot seek to %lld", cfg->name, cfg->pos);
+      tino_file_closeE(fd);
+      return -1;
+    }
+  if (io_open(lag, 0, cfg->qd))
+    {
+      tino_file_closeE(fd);
+      return -1;
+    }
+  if (io_seek(lag, cfg->pos))
+    {
+      io_close(lag);
+      tino_freeO(lag->io);
+      lag->io	= 0;
+      tino_file_closeE(fd);
+      return -1;
+    }
+  return 0;
+}
+
+/* Check everything written up to upto, which is a block boundary or
+ * the end.  Only waits for reads if wait is set, else it returns as
+ * soon as the next read is still in flight.
+ */
+static int
+lag_read(CFG, long long upto, int wait)
+{
+  struct diskus_cfg	*lag=cfg->lagcfg;
+  struct diskus_io	*io=lag->io;
+  struct diskus_slot	*slot;
+  unsigned char		*block;
+  int			got;
 
-	  if (SECTOR_OFFSET(got))
-	    {
-	      TINO_ERR5("ETTDU108A %s: partial sector read: %d pos=%lld (%lld+%d)", cfg->name, SECTOR_OFFSET(got), cfg->pos+got, cfg->pos, got);
-	      return diskus_ret_short;
-	    }
+  if (upto>lag->endpos)
+    lag->endpos	= upto;
+  if (!lag->endpos)
+    return 0;		/* 0 is no limit for io_fill()	*/
+  if (io_fill(lag))
+    return -1;
+  while (wait || io_ready(lag))
+    {
+      if ((got=io_read(lag, &block))==0 && !io->cnt)
+	break;
+      slot	= &io->slot[io->head];
+      lag->pos	= slot->pos;
+      lag->nr	= lag->pos/lag->ssz;
+      if (got<slot->len)
+	{
+	  keep_mark(lag, slot->pos, slot->pos+slot->len, 'R');
+	  lag->nxt	= slot->pos+slot->len;
+	  diskus_err(lag, ERR_READ, diskus_ret_read, "verify read error, skip block of %d sectors", slot->len/lag->ssz);
+	  if (io_seek(lag, lag->nxt) || tino_file_lseekE(lag->fd, lag->nxt, SEEK_SET)!=lag->nxt)
+	    return -1;
+	  continue;
+	}
+      keep_mark(lag, slot->pos, slot->pos+got, lag->keepok);
+      check_worker(lag, block, got);
+      if (lag->rcount && lag->nr>lag->rto)
+	range_close(lag);
+    }
+  return 0;
+}
 
-	  want	= cfg->pos+got;
+/* Check the rest up to end and hand the errors to the writer
+ */
+static void
+lag_close(CFG, long long end)
+{
+  struct diskus_cfg	*lag=cfg->lagcfg;
+  int			ret;
 
-	  if ((got=worker(cfg, block, got))!=0)
-	    break;
+  if (!lag || !lag->io)
+    return;
+  ret	= lag_read(cfg, end, 1);
+  if (io_close(lag) || tino_file_closeE(lag->fd) || ret)
+    {
+      TINO_ERR3("ETTDU101A %s: read error at sector %lld pos=%siB", lag->name, lag->nr, get_pos_str(lag));
+      lag->retflags	|= diskus_ret_read;
+    }
+  range_close(lag);
+  if (lag->err)
+    {
+      if (!cfg->err)
+	cfg->firsterr	= lag->firsterr;
+      cfg->lasterr	= lag->lasterr;
+      cfg->errtype	= lag->errtype;
+      cfg->err		+= lag->err;
+    }
+  cfg->retflags	|= lag->retflags;
+  tino_freeO(lag->io);
+  lag->io	= 0;
+}
+
+static int
+run_write(CFG, diskus_worker_fn worker)
+{
+  int			put, offload, blk;
+  unsigned char		*block;
+  struct diskus_io	*io;
+
+  if (!cfg->ts)
+    cfg->ts	= time(NULL);	/* preset for -jobs	*/
+  if ((cfg->fd=tino_file_openE(cfg->name, O_WRONLY|(cfg->async ? 0 : O_SYNC)))<0)
+    {
+      TINO_ERR1("ETTDU104A %s: cannot open for write", cfg->name);
+      return diskus_ret_param;
+    }
+  cfg->nr	= 0;
+  if (cfg->pos)
+    {
+      cfg->nr	= cfg->pos/cfg->ssz;
+      if (tino_file_lseekE(cfg->fd, cfg->pos, SEEK_SET)!=cfg->pos)
+	{
+	  TINO_ERR2("ETTDU106A %s: cannot seek to %lld", cfg->name, cfg->pos);
+	  return diskus_ret_seek;
+	}
+    }
+  /* A queueing engine keeps at least two blocks in flight, so the
+   * next block is generated while the previous one is written.  -qd 1
+   * without -engine stays plain sync I/O.
+   */
+  if (io_open(cfg, 1, cfg->qd<2 && cfg->engine && strcmp(cfg->engine, "auto") ? 2 : cfg->qd))
+    {
+      tino_file_closeE(cfg->fd);
+      return diskus_ret_param;
+    }
+  io	= cfg->io;
+  io_seek(cfg, cfg->pos);
+
+  offload	= 0;
+  blk		= 0;
+  if (cfg->offload && worker==null_worker)
+    {
+#ifdef DISKUS_ZEROOUT
+      struct stat	st;
+
+      if (!fstat(cfg->fd, &st))
+	{
+	  offload	= 1;
+	  blk		= S_ISBLK(st.st_mode);
+	}
+#endif
+      if (!offload && !cfg->quiet)
+	TINO_ERR1("WTTDU144 %s: cannot offload zeroing, writing NUL instead", cfg->name);
+    }
+  if (worker(cfg, NULL, 0))
+    {
+      TINO_ERR1("FTTDU115A %s: internal fatal error, worker could not be initialized", cfg->name);
+      return diskus_ret_param;
+    }
+  if (cfg->lag && lag_open(cfg))
+    {
+      io_close(cfg);
+      tino_file_closeE(cfg->fd);
+      return diskus_ret_param;
+    }
+
+  while (!cfg->endpos || cfg->pos<cfg->endpos)
+    {
+      long long	want;
+      int	max;
+
+      max	= cfg->bs;
+      if (cfg->endpos && cfg->pos+max>cfg->endpos)
+	max	= cfg->endpos-cfg->pos;
 
-	  if (cfg->pos!=want || cfg->nr!=want/SECTOR_SIZE)
+      block	= io_buf(cfg);
+      if (worker==null_worker)
+	block	= io->slot[0].buf;	/* all blocks share the same NULs	*/
+      want	= cfg->pos+max;
+      if (worker(cfg, block, max))
+	{
+	  TINO_ERR1("FTTDU116A %s: internal fatal error, worker signals error", cfg->name);
+	  return diskus_ret_param;
+	}
+      if (cfg->pos!=want || cfg->nr!=want/cfg->ssz)
+	{
+	  TINO_ERR1("FTTDU119A %s: internal fatal error, worker failed to update counters", cfg->name);
+	  return diskus_ret_param;
+	}
+      TINO_ALARM_RUN();
+
+      if (offload)
+	{
+	  if (!zero_range(cfg, blk, want-max, max))
 	    {
-	      TINO_ERR1("FTTDU118A %s: internal fatal error, worker failed to update counters", cfg->name);
-	      return diskus_ret_param;
+	      keep_mark(cfg, want-max, want, cfg->keepok);
+	      offload++;
+	      continue;
+	    }
+	  /* Not supported or past the end.  Writing tells which.
+	   */
+	  if (offload==1 && !cfg->quiet)
+	    TINO_ERR1("WTTDU144 %s: cannot offload zeroing, writing NUL instead", cfg->name);
+	  offload	= 0;
+	  if (io_seek(cfg, want-max) || tino_file_lseekE(cfg->fd, want-max, SEEK_SET)!=want-max)
+	    {
+	      TINO_ERR2("ETTDU106A %s: cannot seek to %lld", cfg->name, want-max);
+	      return diskus_ret_seek;
 	    }
 	}
 
-      if (got>0)
-	continue;
-      if (!got)
+      if (io_write(cfg, block, max))
 	break;
-
-      if (backoff(cfg))
+      if (cfg->lag && lag_read(cfg, (io->cnt ? io->slot[io->head].pos : io->next)-cfg->lagcfg->lag, 0))
 	{
-	  TINO_ERR3("ETTDU101A %s: read error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
+	  TINO_ERR3("ETTDU101A %s: read error at sector %lld pos=%siB", cfg->name, cfg->lagcfg->nr, get_pos_str(cfg->lagcfg));
 	  return diskus_ret_read;
 	}
+    }
+  if (cfg->lag)
+    lag_close(cfg, io_sync(cfg) ? io->failpos : cfg->pos);
 
-      diskus_err(cfg, ERR_READ, diskus_ret_read, "read error, skip %llu to sector %llu", (cfg->nxt-cfg->pos)/SECTOR_SIZE, cfg->nxt/SECTOR_SIZE);
-      cfg->pos	= cfg->nxt;
+  put	= 0;
+  errno	= 0;
+  if (io_sync(cfg))
+    {
+      /* Turn back the time to the start position of the first failed
+       * block, everything queued behind it does not count.
+       *
+       * This also fixes an error in versions before 0.5.0 on write errors
+       */
+      cfg->pos	= io->failpos;
+      cfg->nr	= io->failpos/cfg->ssz;
+      put	= io->failput;
+      errno	= io->failerr;
     }
 
-  if (tino_file_closeE(cfg->fd))
+  /* put always is >= 0, we see the error in errno	*/
+  if (errno==ENOSPC)
     {
-      TINO_ERR3("ETTDU101A %s: read error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
-      return diskus_ret_read;
+      /* correct the counts to the current position
+       */
+      if (SSZ_OFFSET(put))
+	{
+	  TINO_ERR5("ETTDU109A %s: partial sector written: %d pos=%lld (%lld+%d)", cfg->name, SSZ_OFFSET(put), cfg->pos+put, cfg->pos, put);
+	  return diskus_ret_short;
+	}
+      cfg->pos	+= put;
+      cfg->nr	-= put/cfg->ssz;
+      errno	= 0;
     }
-  if (worker(cfg, NULL, 0))
+  if (io_close(cfg) || errno || tino_file_closeE(cfg->fd))
     {
-      TINO_ERR1("FTTDU114A %s: internal fatal error, worker could not be flushed", cfg->name);
+      TINO_ERR3("ETTDU105A %s: write error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
+      return diskus_ret_write;
+    }
+  return diskus_ret_ok;
+}
+
+/* Option -bench
+ *
+ * Timed passes over the region with each combination of blocksize
+ * and queue depth.  They use run_read() or run_write() with the
+ * normal workers, so the numbers are what read or gen achieve.
+ * bench_worker() ends a pass early by pulling in cfg->endpos, or
+ * the end of the -walk.  Writes are always sequential.
+ */
+#define	BENCH_REGION	(1ll<<30)	/* default without -to	*/
+#define	BENCH_MAX	32		/* entries in a list	*/
+
+static int
+bench_worker(CFG, unsigned char *ptr, int len)
+{
+  int	ret;
+
+  ret	= cfg->benchfn(cfg, ptr, len);
+  if (!ptr || len<=0 || diskus_usec()<cfg->benchend)
+    return ret;
+  if (cfg->walk)
+    cfg->walkdom	= cfg->io->step;
+  else if (!cfg->endpos || cfg->endpos>cfg->pos)
+    cfg->endpos	= cfg->pos;
+  return ret;
+}
+
+/* Parse a comma separated list like "4K,64K,1M".
+ * Returns the number of values, -1 on error.
+ */
+static int
+bench_list(const char *s, int *v, int min, int max)
+{
+  int	n;
+
+  for (n=0; *s; n++)
+    {
+      char		*end;
+      long long		x;
+
+      x	= strtoll(s, &end, 0);
+      switch (*end)
+	{
+	case 'k': case 'K':	x <<= 10; end++; break;
+	case 'm': case 'M':	x <<= 20; end++; break;
+	}
+      if (end==s || n>=BENCH_MAX || x<min || x>max || (*end && *end!=','))
+	return -1;
+      v[n]	= x;
+      s		= *end ? end+1 : end;
+    }
+  return n;
+}
+
+static int
+run_bench(CFG, diskus_worker_fn worker)
+{
+  int			bs[BENCH_MAX], qd[BENCH_MAX], nbs, nqd, nwalk, i, k, w, ret;
+  char			*walk[BENCH_MAX], *buf, *tmp;
+  long long		from, to;
+  diskus_run_fn		*run;
+
+  nbs	= bench_list(cfg->benchbs, bs, SECTOR_SIZE, 16*1024*1024);
+  nqd	= bench_list(cfg->benchqd, qd, 1, 1024);
+  for (i=0; i<nbs; i++)
+    if (SSZ_OFFSET(bs[i]))
+      nbs	= -1;
+  if (nbs<=0 || nqd<=0)
+    {
+      TINO_ERR2("ETTDU148F wrong -benchbs or -benchqd list: %s / %s", cfg->benchbs, cfg->benchqd);
       return diskus_ret_param;
     }
-  return 0;
+
+  buf	= tino_allocO(strlen(cfg->benchwalk)+4);
+  strcpy(buf, worker==gen_worker ? "seq" : cfg->benchwalk);
+  for (nwalk=0, tmp=buf; tmp && nwalk>=0; )
+    {
+      struct diskus_cfg	c;
+
+      walk[nwalk]	= tmp;
+      if ((tmp=strchr(tmp, ','))!=NULL)
+	*tmp++	= 0;
+      if (walk_parse(&c, walk[nwalk]) || ++nwalk>=BENCH_MAX)
+	nwalk	= -1;
+    }
+  if (nwalk<=0)
+    {
+      TINO_ERR1("ETTDU148F wrong -benchwalk list: %s", cfg->benchwalk);
+      tino_freeO(buf);
+      return diskus_ret_param;
+    }
+
+  from	= cfg->pos;
+  to	= cfg->endpos;
+  if (!to)
+    {
+      to	= from+BENCH_REGION;
+      if (cfg->size && to>cfg->size)
+	to	= cfg->size;
+    }
+  run	= worker==gen_worker ? run_write : run_read;
+
+  tino_data_printfA(cfg->out, "bench %s %s %lld to %lld, %ds per pass\n", cfg->name, run==run_write ? "write" : "read", from, to, cfg->benchtime);
+  tino_data_printfA(cfg->out, "%-12s %9s %5s %-7s %9s %9s %8s %8s %8s\n", "walk", "bs", "qd", "engine", "MB/s", "IOPS", "avg_us", "p99_us", "max_us");
+  ret	= 0;
+  for (w=0; w<nwalk && !ret; w++)
+    for (i=0; i<nbs && !ret; i++)
+      for (k=0; k<nqd && !ret; k++)
+	{
+	  struct diskus_cfg	c;
+	  struct diskus_zone	z;
+	  long long		usec;
+
+	  /* All cells share the pool and the -verify-lag reader of
+	   * cfg, the pool threads are bound to the current cell.
+	   */
+	  c		= *cfg;
+	  if (c.pool)
+	    c.pool->cfg	= &c;
+	  c.bs		= bs[i];
+	  c.qd		= qd[k];
+	  c.keep		= 0;
+	  c.timefile	= 0;
+	  c.quiet	= 1;
+	  c.benchfn	= worker;
+	  walk_parse(&c, walk[w]);
+	  stats_start(&c);
+	  c.benchend	= c.stats.t0+cfg->benchtime*1000000ll;
+	  do
+	    {
+	      c.pos	= from;
+	      c.endpos	= to;
+	      if (c.io)
+		tino_freeO(c.io);
+	      ret	= run(&c, bench_worker);
+	    } while (!ret && !c.err && diskus_usec()<c.benchend);
+	  usec	= diskus_usec()-c.stats.t0;
+
+	  stats_lat(&c, &z);
+	  tino_data_printfA(cfg->out, "%-12s %9d %5d %-7s %9.1f %9.0f %8llu %8llu %8llu\n", walk[w], c.bs, c.io ? c.io->qd : c.qd, c.io ? c.io->e->name : "-",
+			    c.stats.bytes/(double)usec, z.count*1000000./usec, z.count ? z.sum/z.count : 0, z.count ? zone_percentile(&z, 99) : 0, z.max);
+	  tino_data_syncA(cfg->out, 0);
+	  if (c.io)
+	    tino_freeO(c.io);
+	  cfg->err	+= c.err;
+	  cfg->retflags	|= c.retflags;
+	  cfg->pool	= c.pool;
+	  cfg->lagcfg	= c.lagcfg;
+	}
+  if (cfg->pool)
+    cfg->pool->cfg	= cfg;
+  tino_freeO(buf);
+  return ret;
+}
+
+/* gen continues with the timestamp, signature and sector size of the
+ * first gen on this keep file, else the sectors written by the runs
+ * do not match each other.  The first one records them in the
+ * journal.  Returns nonzero if they cannot be continued.
+ */
+static int
+keep_gen(CFG)
+{
+  struct diskus_keep	*keep=cfg->keep;
+  int			ret;
+
+  ret	= 0;
+  pthread_mutex_lock(&keep->mutex);
+  if (!keep->ts)
+    {
+      if (!cfg->ts)
+	cfg->ts		= time(NULL);
+      keep->ts		= cfg->ts;
+      keep->sign	= cfg->sign;
+      keep->ssz		= cfg->ssz;
+      fprintf(keep->fd, "# gen ts %lld sign %d sector %d\n", keep->ts, keep->sign, keep->ssz);
+      fflush(keep->fd);
+    }
+  else if (keep->sign!=cfg->sign || keep->ssz!=cfg->ssz)
+    ret	= 1;
+  else
+    cfg->ts	= keep->ts;
+  pthread_mutex_unlock(&keep->mutex);
+  return ret;
+}
+
+/* Option -keep: only run on the ranges selected by -update
+ */
+static int
+run_keep(CFG, diskus_run_fn *run, diskus_worker_fn worker)
+{
+  long long	*r, end;
+  int		n, i, ret;
+
+  if (cfg->keepok=='G' && keep_gen(cfg))
+    {
+      TINO_ERR5("ETTDU160F %s: keep file is from gen with -sign %d and sector size %d, not %d and %d", cfg->name, cfg->keep->sign, cfg->keep->ssz, cfg->sign, cfg->ssz);
+      return diskus_ret_param;
+    }
+  end	= cfg->endpos;
+  if ((n=keep_todo(cfg, cfg->pos, end, &r))<0)
+    return diskus_ret_param;
+  if (!n && !cfg->quiet)
+    TINO_ERR1("WTTDU138 %s: nothing to do for -keep", cfg->name);
+  ret	= 0;
+  for (i=0; i<n && !(ret&diskus_ret_param); i++)
+    {
+      /* The map is in units of 512 bytes	*/
+      cfg->pos		= r[2*i]-SSZ_OFFSET(r[2*i]);
+      cfg->endpos	= r[2*i+1];
+      if (SSZ_OFFSET(cfg->endpos))
+	cfg->endpos	+= cfg->ssz-SSZ_OFFSET(cfg->endpos);
+      ret		|= run(cfg, worker);
+    }
+  cfg->endpos	= end;
+  tino_freeO(r);
+  return ret;
+}
+
+static int
+run_it(CFG, diskus_run_fn *run, const char *name, diskus_worker_fn worker)
+{
+  int			ret;
+  time_t		start, now;
+  long long		from;
+  struct diskus_zone	z;
+
+  cfg->name	= name;
+  if (!cfg->ssz)
+    cfg->ssz	= SECTOR_SIZE;
+  from		= cfg->pos;
+  stats_start(cfg);
+  time(&start);
+  ret	= cfg->keep ? run_keep(cfg, run, worker) : run(cfg, worker);
+  range_close(cfg);
+  ret	|= zone_write(cfg);
+  time(&now);
+  now	-= start;
+  json_summary(cfg, ret, (long)now, cfg->pos-from);
+  stats_lat(cfg, &z);
+  pthread_mutex_lock(&diskus_out);
+  if (diskus_njobs>1 && !cfg->quiet)
+    tino_data_printfA(cfg->out, "%s: ", cfg->label);
+  if (ret || cfg->err)
+    {
+      if (!cfg->quiet)
+        tino_data_printfA(cfg->out, "failed %s mode %s sector %lld pos=%lldMiB+%lld: errs=%d ret=%d", tino_scale_interval(1, (long)now, 2, 4), cfg->mode, cfg->nr, cfg->pos>>20, cfg->pos&((1ull<<20)-1ull), cfg->err, ret);
+    }
+  else if (!cfg->quiet)
+    tino_data_printfA(cfg->out, "success %s mode %s sector %lld pos=%lldMiB+%lld", tino_scale_interval(1, (long)now, 2, 4), cfg->mode, cfg->nr, cfg->pos>>20, cfg->pos&((1ull<<20)-1ull));
+  if (!cfg->quiet && z.count)
+    tino_data_printfA(cfg->out, " %.1fMB/s lat=%llu/%llu/%lluus", cfg->stats.bytes/(double)(diskus_usec()-cfg->stats.t0+1), z.min, z.sum/z.count, zone_percentile(&z, 99));
+  if (!cfg->quiet)
+    tino_data_printfA(cfg->out, "\n");
+  pthread_mutex_unlock(&diskus_out);
+  return cfg->retflags|ret;
+}
+
+/* Device topology probe
+ *
+ * Block devices are asked by ioctl() and sysfs, everything which is
+ * unknown stays 0 (numa -1).  The probe only fills in what was not
+ * given as an option, see add_jobs().
+ */
+#define	PROBE_BS	(1024*1024)	/* largest -bs picked	*/
+#define	PROBE_QD	32		/* largest -qd picked	*/
+#define	DEFAULT_BS	102400		/* -bs for files	*/
+
+struct diskus_topo
+  {
+    int			blk;		/* block device	*/
+    long long		size;
+    int			lss, pss, opt;	/* logical, physical, optimal I/O size	*/
+    int			align;		/* alignment_offset of partitions	*/
+    int			maxio;		/* max_sectors_kb in bytes	*/
+    int			nrreq, rot, numa;
+  };
+
+/* Read a number from sysfs of the device.  Partitions do not have a
+ * queue/ nor device/, those are taken from the disk.
+ */
+static long long
+probe_sysfs(struct stat *st, const char *what, long long def)
+{
+  const char	*dir[] = { "", "../" };
+  char		path[128];
+  long long	val;
+  FILE		*fd;
+  int		i;
+
+  for (i=0; i<2; i++)
+    {
+      snprintf(path, sizeof path, "/sys/dev/block/%u:%u/%s%s", major(st->st_rdev), minor(st->st_rdev), dir[i], what);
+      if ((fd=fopen(path, "r"))==NULL)
+	continue;
+      if (fscanf(fd, "%lld", &val)!=1)
+	val	= def;
+      fclose(fd);
+      return val;
+    }
+  return def;
+}
+
+static void
+probe_device(const char *name, struct diskus_topo *t)
+{
+  int		fd;
+
+  memset(t, 0, sizeof *t);
+  t->lss	= SECTOR_SIZE;
+  t->pss	= SECTOR_SIZE;
+  t->numa	= -1;
+  if ((fd=tino_file_openE(name, O_RDONLY))<0)
+    return;
+#ifdef DISKUS_PROBE
+  {
+    struct stat		st;
+    unsigned long long	size;
+    unsigned int	opt;
+
+    if (!fstat(fd, &st) && S_ISBLK(st.st_mode))
+      {
+	t->blk	= 1;
+	if (!ioctl(fd, BLKGETSIZE64, &size))
+	  t->size	= size;
+	if (ioctl(fd, BLKSSZGET, &t->lss) || ioctl(fd, BLKPBSZGET, &t->pss))
+	  t->lss	= t->pss	= SECTOR_SIZE;
+	if (!ioctl(fd, BLKIOOPT, &opt))
+	  t->opt	= opt;
+	t->align	= probe_sysfs(&st, "alignment_offset", 0);
+	t->maxio	= probe_sysfs(&st, "queue/max_sectors_kb", 0)*1024;
+	t->nrreq	= probe_sysfs(&st, "queue/nr_requests", 0);
+	t->rot		= probe_sysfs(&st, "queue/rotational", 0);
+	t->numa		= probe_sysfs(&st, "device/numa_node", -1);
+	if (t->numa<0)
+	  t->numa	= probe_sysfs(&st, "device/device/numa_node", -1);
+      }
+  }
+#endif
+  if (!t->size)
+    {
+      t->size	= tino_file_lseekE(fd, 0ll, SEEK_END);
+      if (t->size<0)
+	t->size	= 0;
+    }
+  tino_file_closeE(fd);
+}
+
+/* Sector size to use for a device: -sector if given, else the
+ * physical sector size of block devices, such that nothing is written
+ * in parts of a physical sector (512e drives would read-modify-write
+ * internally).  Partitions which are not aligned to the physical
+ * sectors, files and anything unknown use the logical sector size.
+ */
+static int
+get_sector_size(CFG, const struct diskus_topo *t)
+{
+  int	lss, pss;
+
+  lss	= t->lss;
+  pss	= t->align%t->pss ? lss : t->pss;
+  if (cfg->sector)
+    pss	= cfg->sector;
+  if (pss<lss || pss>MAX_SECTOR_SIZE || (pss&(pss-1)))
+    pss	= lss;
+  if (lss<SECTOR_SIZE || lss>MAX_SECTOR_SIZE || (lss&(lss-1)))
+    return -lss;
+  return pss;
+}
+
+/* check has to use the sector size gen wrote with, and older diskus
+ * always wrote logical sectors.  If the second logical sector at
+ * -start carries its own ID, the data is in logical sectors.
+ * Returns the sector size to use.
+ */
+static int
+probe_gen_ssz(CFG, const char *name, const struct diskus_topo *t, int ssz)
+{
+  unsigned char	*buf;
+  long long	pos, nr, cmp;
+  char		*end;
+  int		fd, off, sign;
+
+  pos	= cfg->pos-cfg->pos%ssz+t->lss;
+  nr	= pos/t->lss;
+  if ((fd=tino_file_openE(name, O_RDONLY))<0)
+    return ssz;
+  buf		= tino_allocO(t->lss+1);
+  buf[t->lss]	= 0;
+  if (tino_file_lseekE(fd, pos, SEEK_SET)==pos && tino_file_read_allE(fd, buf, t->lss)==t->lss
+      && (off=find_signature(cfg, buf, nr, t->lss))>=0)
+    {
+      sign	= buf[off+7]=='2' ? 2 : 1;
+      cmp	= strtoll((char *)(buf+off+6+sign), &end, 16);
+      if (end && *end==' ' && cmp==nr)
+	ssz	= t->lss;
+    }
+  tino_freeO(buf);
+  tino_file_closeE(fd);
+  return ssz;
+}
+
+/* Largest block up to PROBE_BS the device takes in one request, in
+ * whole units of the optimal I/O size if the device has one.
+ */
+static int
+probe_bs(const struct diskus_topo *t, int ssz)
+{
+  int	bs;
+
+  if (!t->blk)
+    return DEFAULT_BS;
+  bs	= PROBE_BS;
+  if (t->maxio>=ssz && bs>t->maxio)
+    bs	= t->maxio;
+  if (t->opt>=ssz && t->opt<=bs)
+    bs	-= bs%t->opt;
+  return bs-bs%ssz;
+}
+
+/* Spinning disks gain nothing from deep queues, SSDs do
+ */
+static int
+probe_qd(const struct diskus_topo *t)
+{
+  int	qd;
+
+  if (!t->blk)
+    return 1;
+  if (t->rot)
+    return 2;
+  qd	= t->nrreq ? t->nrreq/4 : 8;
+  return qd<2 ? 2 : qd>PROBE_QD ? PROBE_QD : qd;
 }
 
-static int
-run_read(CFG, diskus_worker_fn worker)
+/* Run the calling thread (and the -threads it starts) on the NUMA
+ * node of the device.
+ */
+static void
+probe_bind(CFG)
 {
-  return run_read_type(cfg, O_RDONLY, O_DIRECT, worker);
+#ifdef DISKUS_PROBE
+  char		path[80], list[1024], *s;
+  cpu_set_t	set;
+  FILE		*fd;
+  int		a, b, n;
+
+  if (cfg->numa<0)
+    return;
+  snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", cfg->numa);
+  if ((fd=fopen(path, "r"))==NULL)
+    return;
+  s	= fgets(list, sizeof list, fd);
+  fclose(fd);
+  if (!s)
+    return;
+  CPU_ZERO(&set);
+  while (sscanf(s, "%d%n", &a, &n)==1)
+    {
+      s	+= n;
+      b	= a;
+      if (*s=='-' && sscanf(s+1, "%d%n", &b, &n)==1)
+	s	+= 1+n;
+      for (; a<=b && a<CPU_SETSIZE; a++)
+	CPU_SET(a, &set);
+      if (*s++!=',')
+	break;
+    }
+  if (CPU_COUNT(&set))
+    pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+#endif
 }
 
-static int
-run_readwrite(CFG, diskus_worker_fn worker)
+static void *
+run_job(void *arg)
 {
-  return run_read_type(cfg, O_RDWR, O_DIRECT|O_SYNC, worker);
+  struct diskus_job	*job=arg;
+
+  probe_bind(&job->cfg);
+  job->ret	= run_it(&job->cfg, job->run, job->name, job->fn);
+  job->done	= 1;
+  return NULL;
 }
 
+/* Add the jobs for a device.  With -jobs the range is split into
+ * shards of whole blocks, each one runs on its own fd.
+ * Returns -1 if the device cannot be used with the options.
+ */
 static int
-run_write(CFG, diskus_worker_fn worker)
+add_jobs(CFG, const char *name, int dev, diskus_run_fn *run, diskus_worker_fn *fn)
 {
-  int	put;
-  void	*block;
+  struct diskus_cfg	tmp;
+  struct diskus_topo	t;
+  long long		from, to, blocks;
+  int			n, k, ssz;
 
-  cfg->ts	= time(NULL);
-  if ((cfg->fd=tino_file_openE(cfg->name, O_WRONLY|(cfg->async ? 0 : O_SYNC)))<0)
+  probe_device(name, &t);
+  if ((ssz=get_sector_size(cfg, &t))<0)
     {
-      TINO_ERR1("ETTDU104A %s: cannot open for write", cfg->name);
-      return diskus_ret_param;
+      TINO_ERR2("ETTDU152F %s: unsupported sector size %d", name, -ssz);
+      return -1;
     }
-  cfg->nr	= 0;
-  if (cfg->pos)
+  if (cfg->sector && cfg->sector!=ssz && !cfg->quiet)
+    TINO_ERR3("WTTDU153 %s: -sector %d is below the logical sector size, using %d", name, cfg->sector, ssz);
+  if (fn==check_worker && !cfg->sector && ssz!=t.lss && (ssz=probe_gen_ssz(cfg, name, &t, ssz))==t.lss && !cfg->quiet)
+    TINO_ERR2("WTTDU164 %s: data was written with %d byte sectors, using them", name, ssz);
+
+  /* Options given win over the probe	*/
+  tmp		= *cfg;
+  cfg		= &tmp;
+  cfg->ssz	= ssz;
+  cfg->numa	= cfg->noprobe ? -1 : t.numa;
+  if (!cfg->bs)
     {
-      cfg->nr	= cfg->pos/SECTOR_SIZE;
-      if (tino_file_lseekE(cfg->fd, cfg->pos, SEEK_SET)!=cfg->pos)
-	{
-	  TINO_ERR2("ETTDU106A %s: cannot seek to %lld", cfg->name, cfg->pos);
-	  return diskus_ret_seek;
-	}
+      cfg->bs		= cfg->noprobe ? DEFAULT_BS : probe_bs(&t, ssz);
+      cfg->probed	|= PROBED_BS;
     }
-  block	= tino_alloc_alignedO(cfg->bs);
-  if (worker(cfg, NULL, 0))
+  if (!cfg->qd)
     {
-      TINO_ERR1("FTTDU115A %s: internal fatal error, worker could not be initialized", cfg->name);
-      return diskus_ret_param;
+      cfg->qd		= cfg->noprobe ? 1 : probe_qd(&t);
+      cfg->probed	|= PROBED_QD;
+    }
+  if (!cfg->endpos && t.blk && t.size>cfg->pos && run!=run_bench && !cfg->noprobe)
+    {
+      cfg->endpos	= t.size-SSZ_OFFSET(t.size);
+      cfg->probed	|= PROBED_END;
+    }
+  if (cfg->probed && t.blk && !cfg->quiet)
+    {
+      pthread_mutex_lock(&diskus_out);
+      tino_data_printfA(cfg->out, "%s: probe %lld bytes, sector %d/%d, opt %d, max %d, nr_requests %d, %s, numa %d: bs %d qd %d to %lld\n",
+			name, t.size, t.lss, t.pss, t.opt, t.maxio, t.nrreq, (t.rot ? "rotational" : "non-rotational"), t.numa, cfg->bs, cfg->qd, cfg->endpos);
+      pthread_mutex_unlock(&diskus_out);
     }
 
-  put	= 0;
-  while (!cfg->endpos || cfg->pos<cfg->endpos)
+  if ((cfg->bs|cfg->vary|cfg->pos|cfg->endpos)&(ssz-1))
     {
-      long long	want;
-      int	max;
+      TINO_ERR2("ETTDU162F %s: -bs, -vary, -start and -to must be multiples of the sector size %d", name, ssz);
+      return -1;
+    }
+  if (cfg->vary>cfg->bs)
+    {
+      TINO_ERR3("ETTDU142F %s: option -vary must be up to -bs %d: %d", name, cfg->bs, cfg->vary);
+      return -1;
+    }
 
-      max	= cfg->bs;
-      if (cfg->endpos && cfg->pos+max>cfg->endpos)
-	max	= cfg->endpos-cfg->pos;
+  from	= cfg->pos;
+  to	= cfg->endpos;
+  n	= cfg->jobs;
+  if (n>1 && !to && (to=t.size)<=from)
+    {
+      TINO_ERR1("WTTDU133 %s: unknown size, ignoring -jobs", name);
+      to	= 0;
+      n		= 1;
+    }
+  blocks	= n>1 ? (to-from+cfg->bs-1)/cfg->bs : 1;
+  if (n>blocks)
+    n	= blocks;
+  for (k=0; k<n; k++)
+    {
+      struct diskus_job	*job=&diskus_jobs[diskus_njobs++];
 
-      want	= cfg->pos+max;
-      if (worker(cfg, block, max))
-	{
-	  TINO_ERR1("FTTDU116A %s: internal fatal error, worker signals error", cfg->name);
-	  return diskus_ret_param;
-	}
-      if (cfg->pos!=want || cfg->nr!=want/SECTOR_SIZE)
+      job->cfg		= *cfg;
+      job->cfg.label	= name;
+      job->run		= run;
+      job->fn		= fn;
+      job->name		= name;
+      job->dev		= dev;
+      job->cfg.dev	= dev;
+      job->cfg.size	= to ? to : t.size;
+      if (n>1)
 	{
-	  TINO_ERR1("FTTDU119A %s: internal fatal error, worker failed to update counters", cfg->name);
-	  return diskus_ret_param;
-	}
-      TINO_ALARM_RUN();
+	  char	*label;
 
-      /* XXX bug alert.  tino_file_write_allE() may behave erratic on
-       * some POSIX systems on EINTR.  However it works on Linux.
-       */
-      put	= tino_file_write_allE(cfg->fd, block, max);
-      if (put!=max)
-	{
-	  /* Turn back the time to the start position
-	   *
-	   * This also fixes an error in versions before 0.5.0 on write errors
-	   */
-	  cfg->pos	-= max;
-	  cfg->nr	-= max/SECTOR_SIZE;
-	  break;
+	  job->cfg.pos		= from+blocks*k/n*cfg->bs;
+	  job->cfg.endpos	= k+1<n ? from+blocks*(k+1)/n*cfg->bs : to;
+	  label			= tino_allocO(strlen(name)+12);
+	  sprintf(label, "%s#%d", name, k);
+	  job->cfg.label	= label;
 	}
+      job->start	= job->cfg.pos;
     }
+  return 0;
+}
 
-  /* put always is >= 0, we see the error in errno	*/
-  if (errno==ENOSPC)
+/* Run all jobs in parallel.  Returns the diskus_ret_* bits of all
+ * jobs combined.
+ */
+static int
+run_jobs(void)
+{
+  int	i, ret, failed;
+
+  if (diskus_njobs==1)
     {
-      /* correct the counts to the current position
-       */
-      if (SECTOR_OFFSET(put))
-	{
-	  TINO_ERR5("ETTDU109A %s: partial sector written: %d pos=%lld (%lld+%d)", cfg->name, SECTOR_OFFSET(put), cfg->pos+put, cfg->pos, put);
-	  return diskus_ret_short;
-	}
-      cfg->pos	+= put;
-      cfg->nr	-= put/SECTOR_SIZE;
-      errno	= 0;
+      run_job(diskus_jobs);
+      return diskus_jobs->ret;
     }
-  if (errno || tino_file_closeE(cfg->fd))
+
+  for (i=0; i<diskus_njobs; i++)
+    if (pthread_create(&diskus_jobs[i].tid, NULL, run_job, &diskus_jobs[i]))
+      {
+	TINO_ERR1("ETTDU131A %s: cannot start thread", diskus_jobs[i].name);
+	diskus_jobs[i].ret	= diskus_ret_param;
+	diskus_jobs[i].done	= 2;
+      }
+  ret		= 0;
+  failed	= 0;
+  for (i=0; i<diskus_njobs; i++)
     {
-      TINO_ERR3("ETTDU105A %s: write error at sector %lld pos=%siB", cfg->name, cfg->nr, get_pos_str(cfg));
-      return diskus_ret_write;
-    }
-  return diskus_ret_ok;
-}
+      struct diskus_job	*job=&diskus_jobs[i];
 
-static int
-run_it(CFG, diskus_run_fn *run, const char *name, diskus_worker_fn worker)
-{
-  int		ret;
-  time_t	start, now;
+      if (job->done!=2)
+	pthread_join(job->tid, NULL);
+      ret	|= job->ret;
+    }
 
-  cfg->name	= name;
-  time(&start);
-  ret	= run(cfg, worker);
-  time(&now);
-  now	-= start;
-  if (ret || cfg->err)
+  if (diskus_jobs->cfg.quiet)
+    return ret;
+  if (isatty(2))
+    fprintf(stderr, "\033[J");		/* remove the progress table	*/
+  tino_data_printfA(diskus_jobs->cfg.out, "summary mode %s:\n", diskus_jobs->cfg.mode);
+  for (i=0; i<diskus_njobs; )
     {
-      if (!cfg->quiet)
-        tino_data_printfA(cfg->out, "failed %s mode %s sector %lld pos=%lldMiB+%lld: errs=%d ret=%d\n", tino_scale_interval(1, (long)now, 2, 4), cfg->mode, cfg->nr, cfg->pos>>20, cfg->pos&((1ull<<20)-1ull), cfg->err, ret);
+      struct diskus_job	*job=&diskus_jobs[i];
+      long long		sectors, first, last;
+      int		errs, res;
+
+      /* merge the shards of a device	*/
+      sectors	= 0;
+      errs	= 0;
+      res	= 0;
+      first	= -1;
+      last	= -1;
+      for (; i<diskus_njobs && diskus_jobs[i].dev==job->dev; i++)
+	{
+	  struct diskus_job	*shard=&diskus_jobs[i];
+
+	  sectors	+= shard->cfg.nr - shard->start/shard->cfg.ssz;
+	  res		|= shard->ret;
+	  if (shard->cfg.err)
+	    {
+	      if (!errs)
+		first	= shard->cfg.firsterr;
+	      last	= shard->cfg.lasterr;
+	    }
+	  errs		+= shard->cfg.err;
+	}
+      tino_data_printfA(job->cfg.out, "%-24s %s sectors %lld errs=%d", job->name, (res || errs ? "failed " : "success"), sectors, errs);
+      if (errs)
+	tino_data_printfA(job->cfg.out, " first=%lld last=%lld", first, last);
+      tino_data_printfA(job->cfg.out, " ret=%d\n", res);
+      if (res || errs)
+	failed++;
     }
-  else if (!cfg->quiet)
-    tino_data_printfA(cfg->out, "success %s mode %s sector %lld pos=%lldMiB+%lld\n", tino_scale_interval(1, (long)now, 2, 4), cfg->mode, cfg->nr, cfg->pos>>20, cfg->pos&((1ull<<20)-1ull));
-  return cfg->retflags|ret;
+  tino_data_printfA(diskus_jobs->cfg.out, "%d devices, %d failed, ret=%d\n", diskus_jobs[diskus_njobs-1].dev+1, failed, ret);
+  return ret;
 }
 
 int
 main(int argc, char **argv)
 {
   static struct diskus_cfg	cfg;
-  int		argn, writemode;
+  int		argn, writemode, i, ret;
+  const char	*jsonfile, *errfile, *walkname;
   diskus_worker_fn	*fn;
   diskus_run_fn	*run;
 
-  argn	= tino_getopt(argc, argv, 1, 1,
+  argn	= tino_getopt(argc, argv, 1, 0,
 		      TINO_GETOPT_VERSION(DISKUS_VERSION)
-		      " blockdev\n"
+		      " blockdev..\n"
 		      "	This is a disk geometry checking and limited repair tool.\n"
 		      "	It writes sectors with individual IDs which later can be\n"
 		      "	checked.  It can 'freshen' (rewrite) all sector data or\n"
-		      "	try to 'patch' unreadable sectors."
+		      "	try to 'patch' unreadable sectors.\n"
+		      "	If several blockdevs are given, they are processed in\n"
+		      "	parallel, the return status is the OR of all devices."
 		      ,
 
 		      TINO_GETOPT_USAGE
@@ -749,8 +4605,44 @@ main(int argc, char **argv)
 		      "		This option makes error reporting less reliable"
 		      , &cfg.async,
 
+		      TINO_GETOPT_STRINGFLAGS
+		      TINO_GETOPT_MIN
+		      "bench	'bench' mode, measure throughput and latency for\n"
+		      "		each -benchbs and -benchqd on the region -start to -to\n"
+		      "		(default 1 GiB).  Reads unless -write, which destroys\n"
+		      "		data like 'gen'.  Use it to find the best -bs and -qd"
+		      , &cfg.mode,
+		      mode_bench,
+
+		      TINO_GETOPT_STRING
+		      TINO_GETOPT_DEFAULT
+		      "benchbs L	Comma separated blocksizes for -bench (suffix K or M)"
+		      , &cfg.benchbs,
+		      "4K,64K,100K,1M,4M",
+
+		      TINO_GETOPT_STRING
+		      TINO_GETOPT_DEFAULT
+		      "benchqd L	Comma separated queue depths for -bench"
+		      , &cfg.benchqd,
+		      "1,4,32",
+
 		      TINO_GETOPT_INT
 		      TINO_GETOPT_DEFAULT
+		      TINO_GETOPT_MIN
+		      TINO_GETOPT_MAX
+		      "benchtime N	Seconds per -bench pass"
+		      , &cfg.benchtime,
+		      5,
+		      1,
+		      3600,
+
+		      TINO_GETOPT_STRING
+		      TINO_GETOPT_DEFAULT
+		      "benchwalk L	Comma separated -walk patterns for -bench (reads only)"
+		      , &cfg.benchwalk,
+		      "seq,random",
+
+		      TINO_GETOPT_INT
 		      TINO_GETOPT_SUFFIX
 		      TINO_GETOPT_MIN
 		      TINO_GETOPT_MAX
@@ -758,12 +4650,13 @@ main(int argc, char **argv)
 		      TINO_GETOPT_MIN_PTR
 #endif
 		      "bs N	Blocksize to operate on (suffix hint: BSKCMGTPEZY)\n"
-		      "		Must be a multiple of the sector size (512 or 4096)"
+		      "		Must be a multiple of the sector size (512 or 4096).\n"
+		      "		Default: what the device takes in one request up to 1M,\n"
+		      "		102400 for files"
 #if 0
 		      , &cfg.vary	/* min_ptr	*/
 #endif
 		      , &cfg.bs,
-		      102400,
 		      SECTOR_SIZE,
 		      16*1024*1024,
 
@@ -779,6 +4672,25 @@ main(int argc, char **argv)
 		      , &cfg.mode,
 		      mode_dump,
 
+		      TINO_GETOPT_STRING
+		      "engine X	I/O engine: auto, sync"
+#ifdef DISKUS_URING
+		      ", uring"
+#endif
+#ifdef DISKUS_AIO
+		      ", aio"
+#endif
+		      "\n"
+		      "		auto uses sync I/O for -qd 1, else the first available\n"
+		      "		of uring, aio, sync.  Mode verify sets this to verify"
+		      , &cfg.engine,
+
+		      TINO_GETOPT_STRING
+		      "errfile file	Append each error to file as binary record of 16 bytes:\n"
+		      "		sector (8), sectors (4), type (1), device (1), reserved (2),\n"
+		      "		little endian.  Output only shows ranges of errors"
+		      , &errfile,
+
 		      TINO_GETOPT_FLAG
 		      "expand	Do not compress output, always print everything\n"
 		      "		for -check and -dump"
@@ -811,6 +4723,24 @@ main(int argc, char **argv)
 		      -1,
 		      SECTOR_SIZE-36,
 #endif
+		      TINO_GETOPT_INT
+		      TINO_GETOPT_DEFAULT
+		      TINO_GETOPT_MIN
+		      TINO_GETOPT_MAX
+		      "jobs N	Split the range into N shards which run in parallel.\n"
+		      "		Each shard has its own fd and buffers, results are merged.\n"
+		      "		Needs -to or a device with known size"
+		      , &cfg.jobs,
+		      1,
+		      1,
+		      1024,
+
+		      TINO_GETOPT_STRING
+		      "json file	Append events to file as JSON lines, one object each.\n"
+		      "		event is error (per error range), progress (each second)\n"
+		      "		or summary.  Positions are given in bytes and sectors"
+		      , &jsonfile,
+
 		      TINO_GETOPT_FLAG
 		      TINO_GETOPT_MAX
 		      "jump	Try to jump over IO errors.  VERY EXPERIMENTAL FEATURE!\n"
@@ -821,12 +4751,13 @@ main(int argc, char **argv)
 		      "		Does not work reliably if option -async is active"
 		      , &cfg.jump,
 		      5,
-#if 0
+
 		      TINO_GETOPT_STRING
 		      "keep file	Use a file to Keep status, created if not exiting.\n"
+		      "		Without -update only sectors not yet processed are run,\n"
+		      "		so an interrupted run continues where it stopped.\n"
 		      "		Use option -update to re-run on certain sectors."
 		      , &cfg.keepfile,
-#endif
 #if 0
 		      TINO_GETOPT_STRING
 		      "log file	Output full log to file"
@@ -838,11 +4769,25 @@ main(int argc, char **argv)
 		      , &cfg.mode,
 		      mode_dump,
 
+		      TINO_GETOPT_FLAG
+		      "noprobe	Do not tune -bs, -qd, -to and the NUMA node of the\n"
+		      "		threads from the device topology (ioctl and sysfs).\n"
+		      "		Without it, a line with the probe results is printed\n"
+		      "		for block devices.  Options given always win"
+		      , &cfg.noprobe,
+
 		      TINO_GETOPT_STRINGFLAGS
 		      TINO_GETOPT_MIN
 		      "null	'null' mode, write NUL to drive"
 		      , &cfg.mode,
 		      mode_null,
+
+		      TINO_GETOPT_FLAG
+		      "offload	With -null let the device zero the range itself, using\n"
+		      "		BLKZEROOUT on block devices or fallocate() on files.\n"
+		      "		Much faster, but the media may not really be written.\n"
+		      "		Falls back to writing NUL if unsupported"
+		      , &cfg.offload,
 #if 0
 		      TINO_GETOPT_STRING
 		      TINO_GETOPT_DEFAULT
@@ -869,6 +4814,17 @@ main(int argc, char **argv)
 		      , &cfg.mode,
 		      mode_patch,
 
+		      TINO_GETOPT_INT
+		      TINO_GETOPT_MIN
+		      TINO_GETOPT_MAX
+		      "qd N	Queue depth, number of blocks kept in flight for -engine.\n"
+		      "		Blocks still are processed in order.  Ignored for\n"
+		      "		-freshen and -patch, which rewrite what was read.\n"
+		      "		Default: 2 for spinning disks, up to 32 for SSD, 1 for files"
+		      , &cfg.qd,
+		      1,
+		      1024,
+
 		      TINO_GETOPT_FLAG
 		      "quiet	Quiet mode, print no progress meter and no result.\n"
 		      "		Success only is signalled in the return status"
@@ -880,6 +4836,33 @@ main(int argc, char **argv)
 		      , &cfg.mode,
 		      mode_read,
 
+		      TINO_GETOPT_INT
+		      TINO_GETOPT_MAX
+		      "retry N	Read and check mode do not stop at read errors, the\n"
+		      "		failed blocks are queued and read again in up to N\n"
+		      "		passes after the scan.  Each pass goes in the other\n"
+		      "		direction with smaller blocks, the last one reads single\n"
+		      "		sectors (or -vary).  With -jump the scan skips further"
+		      , &cfg.retry,
+		      16,
+
+		      TINO_GETOPT_INT
+		      "retrytime N	Seconds for all -retry passes together, what is\n"
+		      "		left then is reported as read errors.  0 is no limit"
+		      , &cfg.retrytime,
+
+		      TINO_GETOPT_INT
+		      TINO_GETOPT_MIN
+		      TINO_GETOPT_MAX
+		      "sector N	Sector size in bytes, 512 to 4096.  Default is the\n"
+		      "		physical sector size of block devices and 512 for files.\n"
+		      "		Sector numbers, IDs and data written by 'gen' depend on it.\n"
+		      "		'check' detects data written with the logical sector size\n"
+		      "		(all diskus before the physical default)"
+		      , &cfg.sector,
+		      SECTOR_SIZE,
+		      MAX_SECTOR_SIZE,
+
 		      TINO_GETOPT_LLONG
 		      TINO_GETOPT_SUFFIX
 		      "start N  Start position N, suffix BKMGTPEZY for Byte, KiB, MiB..\n"
@@ -887,12 +4870,34 @@ main(int argc, char **argv)
 		      "		Use suffix 'S'ector (512) or 'C'D-Rom (4096)."
 		      , &cfg.pos,
 
+		      TINO_GETOPT_INT
+		      TINO_GETOPT_DEFAULT
+		      TINO_GETOPT_MIN
+		      TINO_GETOPT_MAX
+		      "sign N	Signature version written by 'gen', 'check' reads all.\n"
+		      "		1: MD5 based pattern, readable by all diskus versions\n"
+		      "		2: fast pattern, needs less CPU on fast drives"
+		      , &cfg.sign,
+		      1,
+		      1,
+		      2,
+
+		      TINO_GETOPT_INT
+		      TINO_GETOPT_DEFAULT
+		      TINO_GETOPT_MIN
+		      TINO_GETOPT_MAX
+		      "threads N  Number of threads to generate and check sectors.\n"
+		      "		Use together with -qd, such that the drive keeps busy"
+		      , &cfg.threads,
+		      1,
+		      1,
+		      256,
+
 		      TINO_GETOPT_LLONG
 		      TINO_GETOPT_SUFFIX
 		      "to N	End position N, N like in -start option.\n"
 		      "		Use a negative number to give the offset to -start"
 		      , &cfg.endpos,
-#if 0
 		      TINO_GETOPT_STRING
 		      "update R	Update Range for option -keep.  Range is: Letter[From][-To]..\n"
 		      "		From/To are positions with suffix as usual.\n"
@@ -901,18 +4906,45 @@ main(int argc, char **argv)
 		      "		N/G	Sectors Nulled/Generated\n"
 		      "		S/P/M	Sectors Skipped/Past EOF/Missing (=not yet read)"
 		      , &cfg.update,
-#endif
-#if 0
 		      TINO_GETOPT_INT
 		      TINO_GETOPT_SUFFIX
 		      TINO_GETOPT_MIN
-		      TINO_GETOPT_MAX_PTR
+		      TINO_GETOPT_MAX
 		      "vary N	Vary blocksize from this value to the one given above\n"
+		      "		On read errors the block is bisected down to N to\n"
+		      "		locate bad sectors, then the blocksize ramps up again.\n"
 		      "		Must be a multiple of the sector size (512 or 4096)"
-		      , &cfg.bs	/* max_ptr	*/
 		      , &cfg.vary,
-		      0,
-#endif
+		      SECTOR_SIZE,
+		      16*1024*1024,
+
+		      TINO_GETOPT_STRINGFLAGS
+		      TINO_GETOPT_MIN
+		      "verify	'verify' mode, let the drive check the media itself.\n"
+		      "		Uses NVMe Verify or SCSI VERIFY(16), no data is transferred.\n"
+		      "		Only for block devices, -qd is ignored.  Use -jump\n"
+		      "		and -vary to locate errors.  Stops if the drive\n"
+		      "		fails the command for other reasons than the medium"
+		      , &cfg.mode,
+		      mode_verify,
+
+		      TINO_GETOPT_LLONG
+		      TINO_GETOPT_SUFFIX
+		      "verify-lag N	In gen mode, read back and check the data N bytes\n"
+		      "		(rounded up to -bs) behind the write position, with\n"
+		      "		O_DIRECT on a second queue.  Finds lost and misdirected\n"
+		      "		writes in the same pass.  Run check mode afterwards for\n"
+		      "		a final full re-read.  0 (default) is off"
+		      , &cfg.lag,
+
+		      TINO_GETOPT_STRING
+		      "walk X	Access pattern in read, check and verify mode:\n"
+		      "		seq (default), random[:seed], stride:N or butterfly.\n"
+		      "		Every block of -bs is read once, all but seq without -vary.\n"
+		      "		Needs -to or a device with known size.  The random seed\n"
+		      "		is printed for repeats"
+		      , &walkname,
+
 		      TINO_GETOPT_FLAG
 		      "write	Write mode, destroy data (mode 'gen' needs this)"
 		      , &writemode,
@@ -920,11 +4952,11 @@ main(int argc, char **argv)
 		      TINO_GETOPT_FLAG
 		      "xd	Do hexdump of sector in certain error cases"
 		      , &cfg.hexdump,
-#if 0
 		      TINO_GETOPT_STRING
-		      "zone file  Append timing information to file"
+		      "zone file  Append timing information to file.\n"
+		      "		One CSV line per GiB zone with count, min, mean,\n"
+		      "		p50, p90, p99 and max latency in microseconds"
 		      , &cfg.timefile,
-#endif
 		      NULL
 		      );
   if (argn<=0)
@@ -974,21 +5006,32 @@ main(int argc, char **argv)
       fn	= patch_worker;
       run	= run_readwrite;
     }
+  else if (!strcmp(cfg.mode, mode_verify))
+    {
+      fn		= read_worker;
+      cfg.engine	= "verify";
+    }
+  else if (!strcmp(cfg.mode, mode_bench))
+    {
+      fn	= writemode ? gen_worker : read_worker;
+      run	= run_bench;
+    }
 
   if (!fn)
     {
       TINO_ERR1("FTTDU102F unknown mode %s", cfg.mode);
       return diskus_ret_param;
     }
+  cfg.keepok	= fn==check_worker ? 'V' : fn==gen_worker ? 'G' : fn==null_worker ? 'N' : 'O';
+  cfg.numa	= -1;	/* until add_jobs() probes the device	*/
 
 #if 0
   cfg.out	= tino_data_stream(NULL, stdout);
 #else
   cfg.out	= tino_data_fileA(NULL, 1);
 #endif
-  tino_alarm_set(1, print_state, &cfg);
 
-  if (!writemode && run!=run_read)
+  if (!writemode && run!=run_read && run!=run_bench)
     {
       TINO_ERR1("ETTDU103F %s mode needs write option", cfg.mode);
       return diskus_ret_param;
@@ -998,5 +5041,126 @@ main(int argc, char **argv)
       TINO_ERR1("ETTDU110F %s mode must not have write option", cfg.mode);
       return diskus_ret_param;
     }
-  return run_it(&cfg, run, argv[argn], fn);
+  if (fn==dump_worker && (argn+1<argc || cfg.jobs>1))
+    {
+      TINO_ERR1("ETTDU132F %s mode only works on a single device without -jobs", cfg.mode);
+      return diskus_ret_param;
+    }
+  if (run==run_bench && (argn+1<argc || cfg.jobs>1 || cfg.keepfile))
+    {
+      TINO_ERR1("ETTDU149F %s mode only works on a single device without -jobs or -keep", cfg.mode);
+      return diskus_ret_param;
+    }
+
+  if (cfg.sector && (cfg.sector<SECTOR_SIZE || (cfg.sector&(cfg.sector-1))))
+    {
+      TINO_ERR1("ETTDU154F option -sector must be a power of 2 from 512 to 4096: %d", cfg.sector);
+      return diskus_ret_param;
+    }
+  if (cfg.vary && (SECTOR_OFFSET(cfg.vary) || (cfg.bs && cfg.vary>cfg.bs)))
+    {
+      TINO_ERR2("ETTDU142F option -vary must be a multiple of the sector size up to -bs %d: %d", cfg.bs, cfg.vary);
+      return diskus_ret_param;
+    }
+  if (cfg.engine && !strcmp(cfg.engine, "verify") && fn!=read_worker)
+    {
+      TINO_ERR1("ETTDU145F engine verify transfers no data, it cannot be used in %s mode", cfg.mode);
+      return diskus_ret_param;
+    }
+  if (walkname && walk_parse(&cfg, walkname))
+    {
+      TINO_ERR1("ETTDU151F unknown -walk pattern: %s", walkname);
+      return diskus_ret_param;
+    }
+  if (cfg.walk && (run!=run_read || fn==dump_worker))
+    {
+      TINO_ERR1("ETTDU161F option -walk does not work in %s mode", cfg.mode);
+      return diskus_ret_param;
+    }
+  if (cfg.walk && cfg.vary)
+    {
+      TINO_ERR1("ETTDU165F option -walk %s reads whole blocks, it does not work with -vary", walkname);
+      return diskus_ret_param;
+    }
+  if (cfg.lag && (fn!=gen_worker || run!=run_write))
+    {
+      TINO_ERR1("ETTDU156F option -verify-lag only works with gen mode, not %s", cfg.mode);
+      return diskus_ret_param;
+    }
+  if (cfg.lag<0)
+    {
+      TINO_ERR1("ETTDU156F option -verify-lag must not be negative: %lld", cfg.lag);
+      return diskus_ret_param;
+    }
+  if (cfg.retry && (run!=run_read || cfg.walk || fn==dump_worker))
+    {
+      TINO_ERR1("ETTDU157F option -retry only works in read and check mode without -walk, not %s", cfg.mode);
+      return diskus_ret_param;
+    }
+  if (cfg.offload && fn!=null_worker)
+    {
+      TINO_ERR1("ETTDU143F option -offload only works with null mode, not %s", cfg.mode);
+      return diskus_ret_param;
+    }
+  if (jsonfile)
+    {
+      if ((diskus_json=fopen(jsonfile, "a"))==NULL)
+	{
+	  TINO_ERR1("ETTDU146A %s: cannot open JSON file", jsonfile);
+	  return diskus_ret_param;
+	}
+      setvbuf(diskus_json, NULL, _IOFBF, BUFSIZ*16);
+    }
+  if (errfile)
+    {
+      if ((diskus_errfile=fopen(errfile, "ab"))==NULL)
+	{
+	  TINO_ERR1("ETTDU147A %s: cannot open error file", errfile);
+	  return diskus_ret_param;
+	}
+      fseek(diskus_errfile, 0L, SEEK_END);
+      if (!ftell(diskus_errfile))
+	fwrite(ERRFILE_MAGIC, 8, 1, diskus_errfile);
+    }
+  if (cfg.update && !cfg.keepfile)
+    {
+      TINO_ERR0("ETTDU139F option -update needs -keep");
+      return diskus_ret_param;
+    }
+  if (cfg.keepfile)
+    {
+      if (argn+1<argc)
+	{
+	  TINO_ERR0("ETTDU140F option -keep only works on a single device");
+	  return diskus_ret_param;
+	}
+      if ((cfg.keep=keep_open(cfg.keepfile))==NULL)
+	return diskus_ret_param;
+    }
+
+  /* All shards must write the same timestamp
+   */
+  if (run==run_write)
+    cfg.ts	= time(NULL);
+  sector_init();
+  diskus_jobs	= tino_alloc0O((argc-argn) * cfg.jobs * sizeof *diskus_jobs);
+  for (i=argn; i<argc; i++)
+    if (add_jobs(&cfg, argv[i], i-argn, run, fn))
+      return diskus_ret_param;
+  stats_signal();
+  tino_alarm_set(1, print_state, &diskus_jobs->cfg);
+  ret	= run_jobs();
+  if (cfg.keep)
+    ret	|= keep_close(cfg.keep);
+  if (diskus_errfile && fclose(diskus_errfile))
+    {
+      TINO_ERR1("ETTDU147A %s: cannot write error file", errfile);
+      ret	|= diskus_ret_param;
+    }
+  if (diskus_json && fclose(diskus_json))
+    {
+      TINO_ERR1("ETTDU146A %s: cannot write JSON file", jsonfile);
+      ret	|= diskus_ret_param;
+    }
+  return ret;
 }
@@ -0,0 +1,452 @@
+/*
+ * Microbenchmarks for the DISKUS hot path
+ *
+ * Copyright (C)2007-2014 Valentin Hilbig <webmaster@scylla-charybdis.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ *
+ * Usage: diskus_bench [-b baseline] [-s slack%] [file|device..]
+ *
+ * Times the sector kernels on in-memory buffers on a single thread
+ * for 512 and 4096 byte sectors (all times are per 512 bytes),
+ * then the complete run_write()/run_read() loops on each file or
+ * device given (for example a file on /dev/shm or a loop device).
+ * Files are created or extended to BENCH_FILE bytes, devices are
+ * OVERWRITTEN in the first BENCH_FILE bytes.
+ *
+ * Each result is one line "name ns/sector GB/s", the best of
+ * BENCH_ROUNDS (BENCH_FILE_ROUNDS for files) rounds.  This output can
+ * be kept as a baseline.  With -b each result is compared to the
+ * baseline and the exit status is 1 if anything got more than -s
+ * percent (default 25) slower.
+ *
+ * "make bench" does this with bench.baseline, "make bench-baseline"
+ * creates it.
+ *
+ * It also checks that "gen -keep -verify-lag -zone" survives a keep
+ * file with more than one range, and for files that "null -offload"
+ * stops at the right place when zeroing cannot be offloaded (file
+ * size limit).
+ */
+
+#define main diskus_main
+#include "diskus.c"
+#undef main
+
+#include <sys/resource.h>
+
+#define	BENCH_BUF	(4*1024*1024)	/* in-memory buffer	*/
+#define	BENCH_ROUND	100000		/* usec per round	*/
+#define	BENCH_ROUNDS	5
+#define	BENCH_FILE	(64ll*1024*1024)
+#define	BENCH_FILE_ROUNDS	3
+#define	BENCH_BASE	256		/* baseline entries	*/
+#define	BENCH_NOISE	0.5		/* ns/sector always ok	*/
+
+typedef int bench_fn(CFG, unsigned char *, int);
+
+static struct
+  {
+    char		name[64];
+    double		ns;
+  }			bench_base[BENCH_BASE];
+static int		bench_nbase, bench_slack = 25, bench_ret;
+static volatile int	bench_sink;	/* keeps the results alive	*/
+
+static unsigned char	bench_pat[16];
+static char		bench_id[64];
+static int		bench_len;
+
+static void
+bench_load(const char *name)
+{
+  FILE	*fd;
+  char	line[256];
+
+  if ((fd=fopen(name, "r"))==NULL)
+    {
+      fprintf(stderr, "# no baseline %s, nothing compared\n", name);
+      return;
+    }
+  while (bench_nbase<BENCH_BASE && fgets(line, sizeof line, fd))
+    if (*line!='#' && sscanf(line, "%63s %lf", bench_base[bench_nbase].name, &bench_base[bench_nbase].ns)==2)
+      bench_nbase++;
+  fclose(fd);
+}
+
+static void
+bench_result(const char *name, double ns)
+{
+  int	i;
+
+  printf("%-40s %10.2f ns/sector %8.3f GB/s\n", name, ns, SECTOR_SIZE/ns);
+  fflush(stdout);
+  for (i=bench_nbase; --i>=0; )
+    if (!strcmp(bench_base[i].name, name))
+      {
+	if (ns > bench_base[i].ns*(100+bench_slack)/100 + BENCH_NOISE)
+	  {
+	    fprintf(stderr, "# SLOWER %s: %.2f ns/sector, baseline %.2f\n", name, ns, bench_base[i].ns);
+	    bench_ret	= 1;
+	  }
+	break;
+      }
+}
+
+/* Wrappers such that all kernels run the same way
+ */
+static int
+bench_create(CFG, unsigned char *ptr, int len)
+{
+  long long	nr;
+
+  for (nr=0; len>0; len-=cfg->ssz, ptr+=cfg->ssz)
+    create_sector(nr++, ptr, bench_pat, bench_id, bench_len, cfg->ssz);
+  return 0;
+}
+
+static int
+bench_find(CFG, unsigned char *ptr, int len)
+{
+  long long	nr;
+  int		ret;
+
+  for (ret=0, nr=0; len>0; len-=cfg->ssz, ptr+=cfg->ssz)
+    ret	|= find_signature(cfg, ptr, nr++, cfg->ssz);
+  return ret;
+}
+
+static int
+bench_check(CFG, unsigned char *ptr, int len)
+{
+  cfg->nr	= 0;
+  return check_worker(cfg, ptr, len);
+}
+
+static int
+bench_gen(CFG, unsigned char *ptr, int len)
+{
+  cfg->nr	= 0;
+  return gen_worker(cfg, ptr, len);
+}
+
+static void
+bench_kernel(CFG, const char *name, bench_fn *fn, unsigned char *buf)
+{
+  double	best;
+  int		i;
+
+  best	= 0;
+  for (i=0; i<BENCH_ROUNDS; i++)
+    {
+      long long	start, usec, n;
+
+      start	= diskus_usec();
+      n		= 0;
+      do
+	{
+	  bench_sink	+= fn(cfg, buf, BENCH_BUF);
+	  n	+= BENCH_BUF/SECTOR_SIZE;
+	} while ((usec=diskus_usec()-start)<BENCH_ROUND);
+      if (!i || usec*1000./n<best)
+	best	= usec*1000./n;
+    }
+  bench_result(name, best);
+}
+
+static void
+bench_kernels(void)
+{
+  static struct diskus_cfg	cfg;
+  static const int		sizes[] = { 512, 4096 };
+  unsigned char			*buf, *tmp;
+  char				name[64];
+  const char			*sfx;
+  int				sign, k;
+
+  buf	= tino_alloc_alignedO(BENCH_BUF);
+  tmp	= tino_alloc_alignedO(BENCH_BUF);
+  cfg.out	= tino_data_fileA(NULL, 2);
+  cfg.name	= "(memory)";
+  cfg.numa	= -1;
+  cfg.threads	= 1;
+  cfg.ts	= 1234567890;
+  for (k=0; k<sizeof sizes/sizeof *sizes; k++)
+    for (sign=1; sign<=2; sign++)
+      {
+	cfg.ssz		= sizes[k];
+	cfg.sign	= sign;
+	sfx		= cfg.ssz==SECTOR_SIZE ? "" : "/4k";
+	bench_len	= sector_id(bench_id, sizeof bench_id, sign, 1, cfg.ts);
+	sector_pat(bench_pat, sign, 1, cfg.ts, bench_id, bench_len);
+
+	snprintf(name, sizeof name, "create_sector/sign%d%s", sign, sfx);
+	bench_kernel(&cfg, name, bench_create, tmp);
+
+	snprintf(name, sizeof name, "gen_worker/sign%d%s", sign, sfx);
+	bench_kernel(&cfg, name, bench_gen, buf);
+
+	sector_predict(&cfg);
+	snprintf(name, sizeof name, "find_signature/sign%d%s", sign, sfx);
+	bench_kernel(&cfg, name, bench_find, buf);
+
+	cfg.siglen[0]	= 0;
+	cfg.siglen[1]	= 0;
+	snprintf(name, sizeof name, "find_signature/scan%d%s", sign, sfx);
+	bench_kernel(&cfg, name, bench_find, buf);
+
+	snprintf(name, sizeof name, "check_worker/sign%d%s", sign, sfx);
+	bench_kernel(&cfg, name, bench_check, buf);
+	if (cfg.err)
+	  {
+	    fprintf(stderr, "# %s found %d errors in gen_worker output\n", name, cfg.err);
+	    bench_ret	= 1;
+	    cfg.err	= 0;
+	  }
+      }
+  bench_kernel(&cfg, "null_worker", null_worker, buf);
+  tino_freeO(tmp);
+  tino_freeO(buf);
+}
+
+/* Full loops including the I/O engine, on a scratch file or device
+ */
+static void
+bench_file(const char *file)
+{
+  static const struct
+    {
+      const char		*name;
+      diskus_run_fn		*run;
+      diskus_worker_fn		*fn;
+    } pass[] =
+    {
+      { "gen",	run_write,	gen_worker	},
+      { "check",	run_read,	check_worker	},
+      { "read",	run_read,	read_worker	},
+      { "null",	run_write,	null_worker	},
+    };
+  struct diskus_topo	t;
+  struct stat		st;
+  int			fd, async, i;
+
+  if (stat(file, &st) || (S_ISREG(st.st_mode) && st.st_size<BENCH_FILE))
+    {
+      if ((fd=open(file, O_WRONLY|O_CREAT, 0600))<0 || ftruncate(fd, BENCH_FILE) || close(fd))
+	{
+	  perror(file);
+	  bench_ret	= 1;
+	  return;
+	}
+    }
+  probe_device(file, &t);
+
+  /* tmpfs has no O_DIRECT	*/
+  async	= 0;
+  if ((fd=open(file, O_RDONLY|O_DIRECT))<0)
+    async	= 1;
+  else
+    close(fd);
+
+  for (i=0; i<sizeof pass/sizeof *pass; i++)
+    {
+      char	name[256];
+      double	best;
+      int	k;
+
+      snprintf(name, sizeof name, "%s@%s", pass[i].name, file);
+      best	= 0;
+      for (k=0; k<BENCH_FILE_ROUNDS; k++)
+	{
+	  struct diskus_cfg	cfg;
+	  long long		usec;
+	  int			ret;
+
+	  memset(&cfg, 0, sizeof cfg);
+	  cfg.out	= tino_data_fileA(NULL, 2);
+	  cfg.mode	= pass[i].name;
+	  cfg.name	= file;
+	  cfg.bs	= 1024*1024;
+	  cfg.qd	= 4;
+	  cfg.sign	= 2;
+	  cfg.ssz	= get_sector_size(&cfg, &t);
+	  cfg.numa	= t.numa;	/* -1 if unknown, as in add_jobs()	*/
+	  cfg.async	= async;
+	  cfg.quiet	= 1;
+	  cfg.endpos	= BENCH_FILE;
+	  cfg.size	= BENCH_FILE;
+	  stats_start(&cfg);
+	  ret	= pass[i].run(&cfg, pass[i].fn);
+	  usec	= diskus_usec()-cfg.stats.t0;
+	  if (cfg.io)
+	    tino_freeO(cfg.io);
+	  if (ret || cfg.err || cfg.pos!=BENCH_FILE)
+	    {
+	      fprintf(stderr, "# %s failed: ret=%d errs=%d pos=%lld\n", name, ret, cfg.err, cfg.pos);
+	      bench_ret	= 1;
+	      break;
+	    }
+	  if (!k || usec*1000./(BENCH_FILE/SECTOR_SIZE)<best)
+	    best	= usec*1000./(BENCH_FILE/SECTOR_SIZE);
+	}
+      if (k>=BENCH_FILE_ROUNDS)
+	bench_result(name, best);
+    }
+}
+
+/* -null -offload on a new file with half the size allowed: The
+ * offload fails at the limit, the NUL block written instead must fail
+ * there, too.  Needs a file system which can zero ranges.
+ */
+static void
+bench_offload(const char *file)
+{
+  struct diskus_cfg	cfg;
+  struct rlimit		old, lim;
+  char			name[256];
+  int			fd, ret;
+
+  snprintf(name, sizeof name, "%s.offload", file);
+  if ((fd=open(name, O_WRONLY|O_CREAT|O_TRUNC, 0600))<0 || close(fd))
+    {
+      perror(name);
+      bench_ret	= 1;
+      return;
+    }
+  getrlimit(RLIMIT_FSIZE, &old);
+  lim		= old;
+  lim.rlim_cur	= BENCH_FILE/2;
+  fprintf(stderr, "# %s: offload fallback check, expect a write error\n", name);
+  signal(SIGXFSZ, SIG_IGN);
+  setrlimit(RLIMIT_FSIZE, &lim);
+
+  memset(&cfg, 0, sizeof cfg);
+  cfg.out	= tino_data_fileA(NULL, 2);
+  cfg.mode	= "null";
+  cfg.name	= name;
+  cfg.bs	= 1024*1024;
+  cfg.qd	= 4;
+  cfg.ssz	= SECTOR_SIZE;
+  cfg.numa	= -1;
+  cfg.async	= 1;
+  cfg.quiet	= 1;
+  cfg.offload	= 1;
+  cfg.endpos	= BENCH_FILE;
+  ret	= run_write(&cfg, null_worker);
+  if (cfg.io)
+    tino_freeO(cfg.io);
+
+  setrlimit(RLIMIT_FSIZE, &old);
+  signal(SIGXFSZ, SIG_DFL);
+  unlink(name);
+  if (!(ret&diskus_ret_write) || cfg.pos!=BENCH_FILE/2)
+    {
+      fprintf(stderr, "# offload fallback on %s failed: ret=%d pos=%lld, expected write error at %lld\n", name, ret, cfg.pos, BENCH_FILE/2);
+      bench_ret	= 1;
+    }
+}
+
+/* gen -keep with -verify-lag and -zone on a keep file which leaves
+ * two ranges, such that the reader is opened a second time.
+ */
+static void
+bench_lag(const char *file)
+{
+  struct diskus_cfg	cfg;
+  char			keep[256], zone[256];
+  FILE			*fd;
+  int			ret;
+
+  snprintf(keep, sizeof keep, "%s.keep", file);
+  snprintf(zone, sizeof zone, "%s.zone", file);
+  unlink(zone);
+  if ((fd=fopen(keep, "w"))==NULL || fprintf(fd, "G %lld-%lld\n", BENCH_FILE/4/512, BENCH_FILE/2/512-1)<0 || fclose(fd))
+    {
+      perror(keep);
+      bench_ret	= 1;
+      return;
+    }
+  fprintf(stderr, "# %s: -keep with two ranges and -verify-lag check\n", file);
+
+  memset(&cfg, 0, sizeof cfg);
+  cfg.out	= tino_data_fileA(NULL, 2);
+  cfg.mode	= "gen";
+  cfg.bs	= 1024*1024;
+  cfg.qd	= 4;
+  cfg.sign	= 2;
+  cfg.ssz	= SECTOR_SIZE;
+  cfg.numa	= -1;
+  cfg.async	= 1;
+  cfg.quiet	= 1;
+  cfg.keepok	= 'G';
+  cfg.lag	= 2*cfg.bs;
+  cfg.timefile	= zone;
+  cfg.endpos	= BENCH_FILE;
+  if ((cfg.keep=keep_open(keep))==NULL)
+    {
+      bench_ret	= 1;
+      return;
+    }
+  ret	= run_it(&cfg, run_write, file, gen_worker);
+  ret	|= keep_close(cfg.keep);
+  if (cfg.io)
+    tino_freeO(cfg.io);
+
+  unlink(keep);
+  unlink(zone);
+  if (ret || cfg.err)
+    {
+      fprintf(stderr, "# -keep -verify-lag on %s failed: ret=%d errs=%d\n", file, ret, cfg.err);
+      bench_ret	= 1;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+  int	i;
+
+  for (i=1; i<argc && argv[i][0]=='-'; i+=2)
+    {
+      if (i+1>=argc)
+	break;
+      if (!strcmp(argv[i], "-b"))
+	bench_load(argv[i+1]);
+      else if (!strcmp(argv[i], "-s"))
+	bench_slack	= atoi(argv[i+1]);
+      else
+	break;
+    }
+  if (i<argc && argv[i][0]=='-')
+    {
+      fprintf(stderr, "usage: %s [-b baseline] [-s slack%%] [file|device..]\n", argv[0]);
+      return 2;
+    }
+
+  printf("# diskus %s bench, %d byte sectors\n", DISKUS_VERSION, SECTOR_SIZE);
+  sector_init();
+  bench_kernels();
+  for (; i<argc; i++)
+    {
+      struct stat	st;
+
+      bench_file(argv[i]);
+      bench_lag(argv[i]);
+      if (!stat(argv[i], &st) && S_ISREG(st.st_mode))
+	bench_offload(argv[i]);
+    }
+  return bench_ret;
+}